@@ -0,0 +1,80 @@
+#include <libinotify/filter/mask_filter.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// Compares the mask filter kernels with the plain loop a subscriber would otherwise write.
+// Usage: libinotify_mask_filter_benchmark [events] [rounds]
+int main(int argc, char** argv)
+{
+  std::size_t events = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 20;
+  int rounds = argc > 2 ? std::atoi(argv[2]) : 20;
+
+  // A mix resembling a busy tree: mostly opens, reads and closes, some writes, few directory events
+  const uint32_t kinds[] = {IN_OPEN, IN_ACCESS, IN_ACCESS, IN_CLOSE_NOWRITE, IN_MODIFY, IN_CLOSE_WRITE,
+                            IN_ATTRIB, IN_CREATE, IN_DELETE, IN_MOVED_FROM, IN_MOVED_TO};
+  std::mt19937 random(42);
+  std::vector<uint32_t> masks(events);
+  for (auto& mask : masks) {
+    mask = kinds[random() % std::size(kinds)];
+    if (random() % 10 == 0) {
+      mask |= IN_ISDIR;
+    }
+  }
+
+  struct Subscriber
+  {
+    const char* name;
+    inotify::MaskPredicate predicate;
+  };
+  const Subscriber subscribers[] = {
+    {"writes", {IN_MODIFY | IN_CLOSE_WRITE, 0, 0}},
+    {"file create/delete", {IN_CREATE | IN_DELETE, 0, IN_ISDIR}},
+    {"directories", {0, IN_ISDIR, 0}},
+    {"all but access", {0, 0, IN_ACCESS}},
+  };
+
+  std::vector<uint32_t> expected, selection(events);
+  auto measure = [&](auto&& run) {
+    double best = 1e30;
+    for (int round = 0; round < rounds; ++round) {
+      auto start = std::chrono::steady_clock::now();
+      run();
+      best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best / events;
+  };
+
+  std::printf("%zu events, best of %d rounds, ns per event\n", events, rounds);
+  std::printf("%-20s %10s %10s %10s %10s %10s\n", "subscriber", "selected", "loop", "scalar", "sse2", "avx2");
+  for (const auto& subscriber : subscribers) {
+    double loop = measure([&]() {
+      expected.clear();
+      for (std::size_t i = 0; i < events; ++i) {
+        if (subscriber.predicate.matches(masks[i])) {
+          expected.push_back(static_cast<uint32_t>(i));
+        }
+      }
+    });
+
+    double times[3];
+    const inotify::SimdLevel levels[] = {inotify::SimdLevel::SCALAR, inotify::SimdLevel::SSE2, inotify::SimdLevel::AVX2};
+    for (int level = 0; level < 3; ++level) {
+      if (levels[level] > inotify::detectSimdLevel()) {
+        times[level] = 0;
+        continue;
+      }
+      std::size_t selected = 0;
+      times[level] = measure([&]() {
+        selected = inotify::selectMasks(masks.data(), events, subscriber.predicate, selection.data(), levels[level]);
+      });
+      if (selected != expected.size() || !std::equal(expected.begin(), expected.end(), selection.begin())) {
+        std::fprintf(stderr, "Selection of level %d differs for %s\n", level, subscriber.name);
+        return 1;
+      }
+    }
+    std::printf("%-20s %10zu %10.3f %10.3f %10.3f %10.3f\n", subscriber.name, expected.size(), loop, times[0], times[1], times[2]);
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+#include "../event/event_reader.hpp"
+
+namespace inotify
+{
+    enum class BackendType
+    {
+        INOTIFY,  // One inotify watch per directory (default)
+        FANOTIFY, // One fanotify mark per filesystem or mount, requires CAP_SYS_ADMIN
+        POLLING   // Periodic rescans, for FUSE, overlay or network mounts inotify cannot see into
+    };
+
+    // Receives what a backend reads. Events are reported with inotify masks, wd is the id the
+    // backend returned from addWatch() or announced through directory()
+    class EventSink
+    {
+    public:
+        virtual ~EventSink() = default;
+        virtual void directory(int id, const std::filesystem::path &path) = 0; // A directory the backend found on its own
+        virtual void event(const EventView &event, int64_t timestamp) = 0;
+    };
+
+    // Source of file system events behind one shard of the Watcher. Everything after reading
+    // (filtering, coalescing, rename pairing, the event queue) is shared by all backends
+    class Backend
+    {
+    public:
+        virtual ~Backend() = default;
+
+        // Becomes readable when read() has something to do, waited on by the reader thread
+        virtual int descriptor() const = 0;
+
+        // Returns the id events on path are reported with, -1 with errno set on failure
+        virtual int addWatch(const std::filesystem::path &path) = 0;
+        virtual int removeWatch(int id) = 0;
+
+        // Reads everything pending without blocking, buffer_size is the requested read buffer
+        virtual void read(EventSink &sink, std::size_t buffer_size) = 0;
+
+        // For readers that issue the read() themselves (io_uring): the buffer to read descriptor()
+        // into and its capacity, nullptr if the backend only supports read()
+        virtual char *readBuffer(std::size_t buffer_size, std::size_t &capacity)
+        {
+            (void)buffer_size;
+            capacity = 0;
+            return nullptr;
+        }
+
+        // Handles length bytes a read into readBuffer() returned
+        virtual void parse(EventSink &sink, std::size_t length)
+        {
+            (void)sink;
+            (void)length;
+        }
+
+        // One addWatch() covers the whole tree below the path, recursive() does not walk it
+        virtual bool coversSubtree() const = 0;
+
+        // removeWatch() is confirmed by an IN_IGNORED event, otherwise the id is gone right away
+        virtual bool reportsIgnored() const = 0;
+
+        virtual const char *name() const = 0;
+    };
+}
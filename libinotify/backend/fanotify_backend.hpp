@@ -0,0 +1,531 @@
+#pragma once
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <linux/capability.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "backend.hpp"
+#include "../event/event_reader.hpp"
+#include "../event/file_event.hpp"
+
+namespace inotify
+{
+    enum class FanotifyMark
+    {
+        FILESYSTEM, // Mark the whole filesystem holding the path
+        MOUNT       // Mark only the mount holding the path, the kernel reports no create/delete/rename events for it
+    };
+
+    // One fanotify group reporting directory file handles and entry names (FAN_REPORT_DFID_NAME).
+    // A watched path costs one mark on its filesystem or mount instead of one watch per directory.
+    // Directories are identified by their file handle, resolved to a path the first time they show
+    // up and announced to the sink with an id of their own. Events outside every watched path are
+    // dropped. Inotify masks are reused as they are, FAN_* and IN_* share their values
+    class FanotifyBackend : public Backend
+    {
+    private:
+        struct Root
+        {
+            int id;
+            std::string path;       // Canonical path, events are only reported below it
+            __kernel_fsid_t fsid;
+            int mount_fd;           // Open directory on the filesystem, used to open file handles
+        };
+
+        // MOVED_FROM half of a rename still waiting for its MOVED_TO, without FAN_RENAME
+        struct PendingMove
+        {
+            std::string parent;     // fsid + file handle of the directory it left
+            bool directory;
+            uint32_t cookie;
+        };
+
+        // Half of a rename in the batch being read
+        struct MoveHalf
+        {
+            std::string parent;
+            bool directory;
+            bool from;
+        };
+
+        static constexpr uint64_t EVENTS = FAN_ACCESS | FAN_MODIFY | FAN_ATTRIB | FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE |
+                                           FAN_OPEN | FAN_CREATE | FAN_DELETE | FAN_DELETE_SELF | FAN_MOVE_SELF | FAN_ONDIR;
+        static constexpr uint64_t MOUNT_EVENTS = FAN_ACCESS | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE | FAN_OPEN | FAN_ONDIR;
+        static constexpr std::size_t MIN_BUFFER_SIZE = 4096;
+        static constexpr std::size_t MAX_PENDING_MOVES = 1024;
+
+        int fd_ = -1;
+        FanotifyMark mark_;
+        uint64_t renames_ = FAN_RENAME;                // Falls back to FAN_MOVED_FROM | FAN_MOVED_TO before Linux 5.17
+        EventReader reader_;
+
+        std::mutex mutex_;                             // Guards the members below, watches are added from other threads
+        std::vector<Root> roots_;
+        std::unordered_map<std::string, int> directories_; // fsid + file handle -> id, -1 for a directory outside every root
+        std::unordered_map<int, std::string> handles_; // id -> key into directories_
+        int next_id_ = 1;
+        uint32_t cookie_ = 0;                          // Pairs the halves of a rename, fanotify has no cookies
+        std::string key_;                              // Scratch buffer for lookups
+        std::deque<PendingMove> moves_;                // Reader thread only, like the two below
+        std::vector<MoveHalf> halves_;
+        std::vector<uint32_t> move_cookies_;           // Cookie of every rename half in the batch, in queue order
+
+        static void handleKey(std::string &key, const __kernel_fsid_t &fsid, const struct file_handle *handle)
+        {
+            key.assign(reinterpret_cast<const char *>(&fsid), sizeof(fsid));
+            key.append(reinterpret_cast<const char *>(&handle->handle_type), sizeof(handle->handle_type));
+            key.append(reinterpret_cast<const char *>(handle->f_handle), handle->handle_bytes);
+        }
+
+        // Key of the directory the first DFID_NAME record of an event names, false if it has none
+        static bool parentKey(std::string &key, const struct fanotify_event_metadata *metadata)
+        {
+            const char *record = reinterpret_cast<const char *>(metadata) + metadata->metadata_len;
+            const char *end = reinterpret_cast<const char *>(metadata) + metadata->event_len;
+            while (record + sizeof(struct fanotify_event_info_header) <= end)
+            {
+                const auto *header = reinterpret_cast<const struct fanotify_event_info_header *>(record);
+                if (header->len == 0)
+                {
+                    break;
+                }
+                record += header->len;
+                if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+                {
+                    const auto *info = reinterpret_cast<const struct fanotify_event_info_fid *>(header);
+                    handleKey(key, info->fsid, reinterpret_cast<const struct file_handle *>(info->handle));
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Without FAN_RENAME the kernel queues a MOVED_FROM and a MOVED_TO with nothing to tie them
+        // together, and events of other threads may land between them. They are paired by the
+        // directory handles they carry instead. A rename locks the directories it touches, so an open
+        // MOVED_FROM from the directory of a MOVED_TO is its other half, and otherwise it is the latest
+        // open MOVED_FROM from another directory, renames across directories being serialized per
+        // filesystem. A new MOVED_FROM from a directory closes the open one from there
+        void pairMoves(const struct fanotify_event_metadata *metadata, ssize_t length)
+        {
+            halves_.clear();
+            for (; FAN_EVENT_OK(metadata, length); metadata = FAN_EVENT_NEXT(metadata, length))
+            {
+                if (metadata->vers != FANOTIFY_METADATA_VERSION)
+                {
+                    break;
+                }
+                if (metadata->mask & FAN_Q_OVERFLOW)
+                {
+                    moves_.clear(); // Their other halves may be lost
+                    continue;
+                }
+                if (metadata->mask & (FAN_MOVED_FROM | FAN_MOVED_TO))
+                {
+                    MoveHalf half{std::string(), (metadata->mask & FAN_ONDIR) != 0, (metadata->mask & FAN_MOVED_FROM) != 0};
+                    parentKey(half.parent, metadata);
+                    halves_.push_back(std::move(half));
+                }
+            }
+
+            move_cookies_.assign(halves_.size(), 0);
+            for (std::size_t i = 0; i < halves_.size(); ++i)
+            {
+                const MoveHalf &half = halves_[i];
+                if (half.from)
+                {
+                    move_cookies_[i] = ++cookie_;
+                    std::erase_if(moves_, [&](const PendingMove &move) { return move.parent == half.parent; });
+                    moves_.push_back(PendingMove{half.parent, half.directory, move_cookies_[i]});
+                    if (moves_.size() > MAX_PENDING_MOVES)
+                    {
+                        moves_.pop_front(); // Moved out of the filesystem, or its MOVED_TO was lost
+                    }
+                    continue;
+                }
+
+                auto match = std::find_if(moves_.begin(), moves_.end(), [&](const PendingMove &move)
+                {
+                    return move.directory == half.directory && move.parent == half.parent;
+                });
+                if (match == moves_.end())
+                {
+                    auto latest = std::find_if(moves_.rbegin(), moves_.rend(), [&](const PendingMove &move)
+                    {
+                        return move.directory == half.directory;
+                    });
+                    match = latest == moves_.rend() ? moves_.end() : std::prev(latest.base());
+                }
+                if (match == moves_.end())
+                {
+                    move_cookies_[i] = ++cookie_; // Moved in from another filesystem
+                    continue;
+                }
+                move_cookies_[i] = match->cookie;
+                moves_.erase(match);
+            }
+        }
+
+        static bool hasSysAdmin()
+        {
+            struct __user_cap_header_struct header = {_LINUX_CAPABILITY_VERSION_3, 0};
+            struct __user_cap_data_struct data[_LINUX_CAPABILITY_U32S_3] = {};
+            return syscall(SYS_capget, &header, data) == 0 && (data[CAP_TO_INDEX(CAP_SYS_ADMIN)].effective & CAP_TO_MASK(CAP_SYS_ADMIN));
+        }
+
+        const Root *rootFor(std::string_view path) const
+        {
+            for (const Root &root : roots_)
+            {
+                if (path.starts_with(root.path) && (path.size() == root.path.size() || path[root.path.size()] == '/' || root.path == "/"))
+                {
+                    return &root;
+                }
+            }
+            return nullptr;
+        }
+
+        // Id of the directory a file handle names, -1 if it lies outside every root or is gone
+        int directoryId(EventSink &sink, const __kernel_fsid_t &fsid, struct file_handle *handle)
+        {
+            std::lock_guard lock(mutex_);
+            handleKey(key_, fsid, handle);
+            auto found = directories_.find(key_);
+            if (found != directories_.end())
+            {
+                return found->second;
+            }
+
+            int mount_fd = -1;
+            for (const Root &root : roots_)
+            {
+                if (std::memcmp(&root.fsid, &fsid, sizeof(fsid)) == 0)
+                {
+                    mount_fd = root.mount_fd;
+                    break;
+                }
+            }
+            int fd = mount_fd < 0 ? -1 : open_by_handle_at(mount_fd, handle, O_PATH | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return -1; // Deleted meanwhile (ESTALE), not cached so a reused handle is looked up again
+            }
+            char link[32];
+            char target[PATH_MAX];
+            std::snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+            ssize_t length = readlink(link, target, sizeof(target));
+            close(fd);
+            if (length <= 0)
+            {
+                return -1;
+            }
+
+            std::filesystem::path path(std::string(target, static_cast<std::size_t>(length)));
+            int id = rootFor(path.native()) ? next_id_++ : -1;
+            directories_.emplace(key_, id);
+            if (id >= 0)
+            {
+                handles_.emplace(id, key_);
+                sink.directory(id, path);
+            }
+            return id;
+        }
+
+        void forget(int id)
+        {
+            auto found = handles_.find(id);
+            if (found != handles_.end())
+            {
+                directories_.erase(found->second);
+                handles_.erase(found);
+            }
+        }
+
+        void handleEvent(EventSink &sink, const struct fanotify_event_metadata *metadata, int64_t timestamp, uint32_t move_cookie)
+        {
+            uint32_t mask = static_cast<uint32_t>(metadata->mask) & (IN_ALL_EVENTS | IN_ISDIR);
+            const char *record = reinterpret_cast<const char *>(metadata) + metadata->metadata_len;
+            const char *end = reinterpret_cast<const char *>(metadata) + metadata->event_len;
+            bool rename = metadata->mask & FAN_RENAME;
+            if (rename)
+            {
+                ++cookie_;
+            }
+
+            while (record + sizeof(struct fanotify_event_info_header) <= end)
+            {
+                const auto *header = reinterpret_cast<const struct fanotify_event_info_header *>(record);
+                if (header->len == 0)
+                {
+                    break;
+                }
+                record += header->len;
+                if (header->info_type != FAN_EVENT_INFO_TYPE_DFID_NAME && header->info_type != FAN_EVENT_INFO_TYPE_DFID &&
+                    header->info_type != FAN_EVENT_INFO_TYPE_OLD_DFID_NAME && header->info_type != FAN_EVENT_INFO_TYPE_NEW_DFID_NAME)
+                {
+                    continue; // e.g. FAN_EVENT_INFO_TYPE_PIDFD
+                }
+
+                auto *info = reinterpret_cast<struct fanotify_event_info_fid *>(const_cast<struct fanotify_event_info_header *>(header));
+                auto *handle = reinterpret_cast<struct file_handle *>(info->handle);
+                std::string_view name;
+                if (header->info_type != FAN_EVENT_INFO_TYPE_DFID)
+                {
+                    name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+                    name = name == "." ? std::string_view() : name;
+                }
+
+                int id = this->directoryId(sink, info->fsid, handle);
+                if (id < 0)
+                {
+                    continue;
+                }
+
+                uint32_t cookie = 0;
+                uint32_t event_mask = mask;
+                if (rename)
+                {
+                    // One FAN_RENAME carries both ends, split it the way inotify reports a rename. If
+                    // only one end lies inside a root the other half is dropped, a move in or out
+                    event_mask = (mask & IN_ISDIR) | (header->info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME ? IN_MOVED_FROM : IN_MOVED_TO);
+                    cookie = cookie_;
+                }
+                else if (mask & (IN_MOVED_FROM | IN_MOVED_TO))
+                {
+                    cookie = move_cookie; // Paired by pairMoves()
+                }
+                else if ((mask & (IN_DELETE_SELF | IN_MOVE_SELF)) && !name.empty())
+                {
+                    continue; // A file, its parent reports the same change as DELETE or MOVED_FROM
+                }
+
+                sink.event(EventView{id, event_mask, cookie, name}, timestamp);
+                if (mask & IN_DELETE_SELF)
+                {
+                    sink.event(EventView{id, IN_IGNORED, 0, {}}, timestamp);
+                    std::lock_guard lock(mutex_);
+                    this->forget(id);
+                }
+            }
+
+            if ((rename || (mask & IN_MOVED_TO)) && (mask & IN_ISDIR))
+            {
+                // A directory moved in from outside has to be resolved again
+                std::lock_guard lock(mutex_);
+                std::erase_if(directories_, [](const auto &entry) { return entry.second < 0; });
+            }
+        }
+
+    public:
+        explicit FanotifyBackend(FanotifyMark mark = FanotifyMark::FILESYSTEM)
+            : mark_(mark)
+        {
+            // Since Linux 5.13 the group itself is granted without privileges, but not the filesystem
+            // and mount marks, so the missing capability is reported here rather than by addWatch()
+            errno = EPERM;
+            if (hasSysAdmin())
+            {
+                fd_ = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+            }
+            if (fd_ < 0)
+            {
+                switch(errno)
+                {
+                    case EPERM:
+                        spdlog::error("fanotify requires CAP_SYS_ADMIN.");
+                        throw std::runtime_error("fanotify requires CAP_SYS_ADMIN.");
+                    case EINVAL:
+                        spdlog::error("The kernel does not support FAN_REPORT_DFID_NAME (Linux 5.9 or later).");
+                        throw std::invalid_argument("The kernel does not support FAN_REPORT_DFID_NAME (Linux 5.9 or later).");
+                    case EMFILE:
+                        spdlog::error("User limit on total number of fanotify groups has been reached.");
+                        throw std::runtime_error("User limit on total number of fanotify groups has been reached.");
+                    default:
+                        spdlog::error("Failed to initialize fanotify: {}", std::strerror(errno));
+                        throw std::runtime_error("Failed to initialize fanotify.");
+                }
+            }
+            reader_.resize(EventReader::DEFAULT_BUFFER_SIZE);
+        }
+
+        ~FanotifyBackend() override
+        {
+            for (const Root &root : roots_)
+            {
+                close(root.mount_fd);
+            }
+            close(fd_);
+        }
+
+        FanotifyBackend(const FanotifyBackend &) = delete;
+        FanotifyBackend &operator=(const FanotifyBackend &) = delete;
+
+        int descriptor() const override { return fd_; }
+
+        int addWatch(const std::filesystem::path &path) override
+        {
+            std::error_code error;
+            std::filesystem::path canonical = std::filesystem::canonical(path, error);
+            if (error)
+            {
+                errno = error.value();
+                return -1;
+            }
+
+            alignas(struct file_handle) char storage[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+            auto *handle = reinterpret_cast<struct file_handle *>(storage);
+            handle->handle_bytes = MAX_HANDLE_SZ;
+            int mount_id;
+            struct statfs filesystem;
+            if (name_to_handle_at(AT_FDCWD, canonical.c_str(), handle, &mount_id, 0) < 0 || statfs(canonical.c_str(), &filesystem) < 0)
+            {
+                return -1;
+            }
+
+            unsigned int type = mark_ == FanotifyMark::FILESYSTEM ? FAN_MARK_FILESYSTEM : FAN_MARK_MOUNT;
+            uint64_t events = (mark_ == FanotifyMark::FILESYSTEM ? EVENTS : MOUNT_EVENTS) | (mark_ == FanotifyMark::FILESYSTEM ? renames_ : 0);
+            if (fanotify_mark(fd_, FAN_MARK_ADD | type, events, AT_FDCWD, canonical.c_str()) < 0)
+            {
+                if (errno != EINVAL || renames_ != FAN_RENAME || mark_ != FanotifyMark::FILESYSTEM)
+                {
+                    return -1;
+                }
+                spdlog::warn("FAN_RENAME is not supported, renames are paired from FAN_MOVED_FROM/FAN_MOVED_TO");
+                renames_ = FAN_MOVED_FROM | FAN_MOVED_TO;
+                if (fanotify_mark(fd_, FAN_MARK_ADD | type, EVENTS | renames_, AT_FDCWD, canonical.c_str()) < 0)
+                {
+                    return -1;
+                }
+            }
+            if (mark_ == FanotifyMark::MOUNT)
+            {
+                spdlog::warn("Mount marks report no create, delete or rename events for {}", canonical.native());
+            }
+
+            int mount_fd = open(canonical.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (mount_fd < 0)
+            {
+                return -1;
+            }
+            std::lock_guard lock(mutex_);
+            int id = next_id_++;
+            __kernel_fsid_t fsid;
+            std::memcpy(&fsid, &filesystem.f_fsid, sizeof(fsid));
+            roots_.push_back(Root{id, canonical.native(), fsid, mount_fd});
+            handleKey(key_, roots_.back().fsid, handle);
+            directories_[key_] = id;
+            handles_[id] = key_;
+            std::erase_if(directories_, [](const auto &entry) { return entry.second < 0; });
+            return id;
+        }
+
+        int removeWatch(int id) override
+        {
+            std::lock_guard lock(mutex_);
+            if (!handles_.contains(id))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            this->forget(id);
+
+            auto root = std::find_if(roots_.begin(), roots_.end(), [id](const Root &root) { return root.id == id; });
+            if (root != roots_.end())
+            {
+                // The mark stays while another root lies on the same filesystem
+                Root removed = *root;
+                roots_.erase(root);
+                close(removed.mount_fd);
+                bool shared = std::any_of(roots_.begin(), roots_.end(), [&](const Root &other)
+                {
+                    return std::memcmp(&other.fsid, &removed.fsid, sizeof(removed.fsid)) == 0;
+                });
+                if (!shared)
+                {
+                    unsigned int type = mark_ == FanotifyMark::FILESYSTEM ? FAN_MARK_FILESYSTEM : FAN_MARK_MOUNT;
+                    fanotify_mark(fd_, FAN_MARK_REMOVE | type, EVENTS | FAN_RENAME | FAN_MOVED_FROM | FAN_MOVED_TO, AT_FDCWD, removed.path.c_str());
+                }
+                // Every other directory is resolved again, it may now lie outside all roots
+                auto root_id = [this](int id)
+                {
+                    return std::any_of(roots_.begin(), roots_.end(), [id](const Root &root) { return root.id == id; });
+                };
+                std::erase_if(directories_, [&](const auto &entry) { return !root_id(entry.second); });
+                std::erase_if(handles_, [&](const auto &entry) { return !root_id(entry.first); });
+            }
+            return 0;
+        }
+
+        void read(EventSink &sink, std::size_t buffer_size) override
+        {
+            buffer_size = std::max(buffer_size, MIN_BUFFER_SIZE);
+            if (buffer_size != reader_.requested())
+            {
+                reader_.resize(buffer_size);
+            }
+
+            while (true)
+            {
+                ssize_t length = reader_.fill(fd_);
+                if (length < 0)
+                {
+                    spdlog::error("Failed to read fanotify events: {}", std::strerror(errno));
+                    return;
+                }
+                if (length == 0)
+                {
+                    return;
+                }
+
+                int64_t timestamp = monotonicNanoseconds();
+                const auto *metadata = reinterpret_cast<const struct fanotify_event_metadata *>(reader_.data());
+                if (renames_ != FAN_RENAME)
+                {
+                    this->pairMoves(metadata, length);
+                }
+                std::size_t move = 0;
+                for (; FAN_EVENT_OK(metadata, length); metadata = FAN_EVENT_NEXT(metadata, length))
+                {
+                    if (metadata->vers != FANOTIFY_METADATA_VERSION)
+                    {
+                        spdlog::error("Unexpected fanotify metadata version {}", metadata->vers);
+                        return;
+                    }
+                    if (metadata->fd >= 0)
+                    {
+                        close(metadata->fd);
+                    }
+                    if (metadata->mask & FAN_Q_OVERFLOW)
+                    {
+                        sink.event(EventView{-1, IN_Q_OVERFLOW, 0, {}}, timestamp);
+                        continue;
+                    }
+                    uint32_t move_cookie = 0;
+                    if (renames_ != FAN_RENAME && (metadata->mask & (FAN_MOVED_FROM | FAN_MOVED_TO)) && move < move_cookies_.size())
+                    {
+                        move_cookie = move_cookies_[move++];
+                    }
+                    this->handleEvent(sink, metadata, timestamp, move_cookie);
+                }
+            }
+        }
+
+        bool coversSubtree() const override { return true; }
+        bool reportsIgnored() const override { return false; }
+        const char *name() const override { return "fanotify"; }
+    };
+}
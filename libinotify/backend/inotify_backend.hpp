@@ -0,0 +1,122 @@
+#pragma once
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+#include "backend.hpp"
+#include "../event/event_reader.hpp"
+#include "../event/file_event.hpp"
+
+namespace inotify
+{
+    // One inotify instance, every watched directory (or file) gets its own watch descriptor
+    class InotifyBackend : public Backend
+    {
+    private:
+        int fd_ = -1;
+        EventReader reader_; // Reusable buffer events are parsed from in place
+
+    public:
+        InotifyBackend()
+        {
+            fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd_ < 0)
+            {
+                switch(errno)
+                {
+                    case EINVAL:
+                        spdlog::error("Invalid value specified in flags for inotify_init1.");
+                        throw std::invalid_argument("Invalid value specified in flags for inotify_init1.");
+                    case EMFILE:
+                        spdlog::error("User limit on total number of inotify instances has been reached.");
+                        throw std::runtime_error("User limit on total number of inotify instances has been reached.");
+                    case ENFILE:
+                        spdlog::error("System-wide limit on total number of open files has been reached.");
+                        throw std::runtime_error("System-wide limit on total number of open files has been reached.");
+                    case ENOMEM:
+                        spdlog::error("Insufficient kernel memory is available.");
+                        throw std::runtime_error("Insufficient kernel memory is available.");
+                    default:
+                        spdlog::error("Failed to initialize inotify.");
+                        throw std::runtime_error("Failed to initialize inotify.");
+                }
+            }
+        }
+
+        ~InotifyBackend() override
+        {
+            close(fd_);
+        }
+
+        InotifyBackend(const InotifyBackend &) = delete;
+        InotifyBackend &operator=(const InotifyBackend &) = delete;
+
+        int descriptor() const override { return fd_; }
+
+        int addWatch(const std::filesystem::path &path) override
+        {
+            return inotify_add_watch(fd_, path.c_str(), IN_ALL_EVENTS);
+        }
+
+        int removeWatch(int id) override
+        {
+            return inotify_rm_watch(fd_, id);
+        }
+
+        void read(EventSink &sink, std::size_t buffer_size) override
+        {
+            if (buffer_size != reader_.requested())
+            {
+                reader_.resize(buffer_size);
+            }
+
+            // The descriptor is non-blocking, drain it until the kernel queue is empty. Each read() fills the
+            // buffer with as many events as fit and the records are walked in place
+            while (true)
+            {
+                ssize_t length = reader_.fill(fd_);
+                if (length < 0)
+                {
+                    spdlog::error("Failed to read inotify events: {}", std::strerror(errno));
+                    return;
+                }
+                if (length == 0)
+                {
+                    return;
+                }
+
+                int64_t timestamp = monotonicNanoseconds();
+                for (const EventView &event : reader_)
+                {
+                    sink.event(event, timestamp);
+                }
+            }
+        }
+
+        char *readBuffer(std::size_t buffer_size, std::size_t &capacity) override
+        {
+            if (buffer_size != reader_.requested())
+            {
+                reader_.resize(buffer_size);
+            }
+            capacity = reader_.capacity();
+            return reader_.data();
+        }
+
+        void parse(EventSink &sink, std::size_t length) override
+        {
+            reader_.assign(length);
+            int64_t timestamp = monotonicNanoseconds();
+            for (const EventView &event : reader_)
+            {
+                sink.event(event, timestamp);
+            }
+        }
+
+        bool coversSubtree() const override { return false; }
+        bool reportsIgnored() const override { return true; }
+        const char *name() const override { return "inotify"; }
+    };
+}
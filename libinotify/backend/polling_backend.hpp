@@ -0,0 +1,425 @@
+#pragma once
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "backend.hpp"
+#include "../event/file_event.hpp"
+#include "../filesystem/snapshot.hpp"
+#include "../index/path_arena.hpp"
+
+namespace inotify
+{
+    // Finds changes by comparing snapshots instead of relying on kernel notifications, for FUSE,
+    // overlay or network mounts where inotify misses changes. Every watched directory keeps the
+    // state (inode, mtime, size, mode) of its entries in a compact snapshot keyed by name. Watched
+    // paths are interned as (parent, name), so a lookup or a directory rename is one arena
+    // operation. Due directories are stat'ed in parallel batches, a directory whose own mtime did
+    // not change is not listed again. A directory with changes is polled again after the minimum
+    // interval, the interval of a quiet one doubles up to the maximum. A timerfd wakes the reader
+    // thread when the next watch is due.
+    // An entry that disappears from one directory and appears with the same inode in another
+    // within one round is reported as MOVED_FROM/MOVED_TO
+    class PollingBackend : public Backend
+    {
+    private:
+        struct Watch
+        {
+            PathArena::Id node;         // (parent, name) entry in paths_, holds one reference
+            bool directory;
+            DirectorySnapshot snapshot; // Entries of a watched directory
+            EntryState state;           // A watched file itself
+            int64_t interval;
+            int64_t due;
+            bool missing = false;       // Gone at the last poll, reported if still gone at the next one
+        };
+
+        struct Result
+        {
+            bool exists = false;
+            DirectorySnapshot snapshot;
+            EntryState state;
+        };
+
+        struct Change
+        {
+            int id;
+            uint32_t mask;
+            std::string name;
+            uint64_t inode = 0;
+            uint32_t cookie = 0;
+            std::size_t partner = SIZE_MAX; // MOVED_TO following this MOVED_FROM
+        };
+
+        static constexpr std::size_t BATCH_SIZE = 32; // Due watches per polling thread
+
+        int timer_fd_ = -1;
+        unsigned threads_;
+        std::atomic<int64_t> min_interval_;
+        std::atomic<int64_t> max_interval_;
+
+        std::mutex mutex_;                       // Guards the members below, watches are added from other threads
+        std::unordered_map<int, Watch> watches_;
+        PathArena paths_;                        // Watched paths, a directory rename moves one entry
+        std::unordered_map<PathArena::Id, int> ids_; // Arena entry -> id of the watch on it
+        int next_id_ = 1;
+        int64_t armed_ = std::numeric_limits<int64_t>::max(); // When the timer fires next
+        uint32_t cookie_ = 0;
+        std::vector<Change> changes_;            // Scratch space of read()
+        std::vector<PathArena::Id> moved_;       // Directories renamed during this round
+
+        void arm(int64_t due)
+        {
+            // CLOCK_MONOTONIC, the clock monotonicNanoseconds() reads
+            struct itimerspec timer = {};
+            due = std::max<int64_t>(due, 1);
+            timer.it_value.tv_sec = due / 1000000000;
+            timer.it_value.tv_nsec = due % 1000000000;
+            if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &timer, nullptr) < 0)
+            {
+                spdlog::error("Failed to arm polling timer: {}", std::strerror(errno));
+            }
+            armed_ = due;
+        }
+
+        std::string path(const Watch &watch) const
+        {
+            return paths_.path(watch.node);
+        }
+
+        void poll(int64_t now)
+        {
+            std::vector<std::pair<int, Watch *>> due;
+            for (auto &[id, watch] : watches_)
+            {
+                if (watch.due <= now)
+                {
+                    due.emplace_back(id, &watch);
+                }
+            }
+            std::vector<int> gone;
+            this->pollWatches(due, now, gone);
+
+            if (std::any_of(changes_.begin(), changes_.end(), [](const Change &change) { return change.mask & IN_DELETE; }))
+            {
+                // A deleted entry may have been moved to a directory that is not due yet. Directories
+                // whose own mtime changed are polled in this round too, at one statx each for the rest
+                std::vector<std::pair<int, Watch *>> rest;
+                std::vector<std::string> paths;
+                for (auto &[id, watch] : watches_)
+                {
+                    if (watch.due > now && watch.directory)
+                    {
+                        rest.emplace_back(id, &watch);
+                        paths.push_back(this->path(watch));
+                    }
+                }
+                std::vector<char> changed(rest.size());
+                unsigned threads = static_cast<unsigned>(std::min<std::size_t>(threads_, (rest.size() + BATCH_SIZE * 8 - 1) / (BATCH_SIZE * 8)));
+                forEachParallel(rest.size(), threads, [&](std::size_t i, std::vector<char> &)
+                {
+                    changed[i] = DirectorySnapshot::directoryTime(paths[i]) != rest[i].second->snapshot.mtime;
+                });
+                due.clear();
+                for (std::size_t i = 0; i < rest.size(); ++i)
+                {
+                    if (changed[i])
+                    {
+                        due.push_back(rest[i]);
+                    }
+                }
+                this->pollWatches(due, now, gone);
+            }
+
+            moved_.clear();
+            this->pairRenames();
+
+            int64_t min_interval = min_interval_.load(std::memory_order_relaxed);
+            for (int id : gone)
+            {
+                Watch &watch = watches_.at(id);
+                bool moved = std::any_of(moved_.begin(), moved_.end(), [&](PathArena::Id node) { return paths_.within(watch.node, node); });
+                if (!watch.missing || moved)
+                {
+                    // Its parent may not have been due yet. If the path was renamed, the parent's poll
+                    // moves the watch along, so the verdict waits one round with the ancestors due now
+                    watch.missing = true;
+                    watch.due = now + min_interval;
+                    for (PathArena::Id node = paths_.parent(watch.node); node != PathArena::NONE; node = paths_.parent(node))
+                    {
+                        auto ancestor = ids_.find(node);
+                        if (ancestor != ids_.end())
+                        {
+                            Watch &other = watches_.at(ancestor->second);
+                            other.due = std::min(other.due, now);
+                        }
+                    }
+                    continue;
+                }
+                changes_.push_back(Change{id, IN_DELETE_SELF, {}});
+                changes_.push_back(Change{id, IN_IGNORED, {}});
+                this->erase(id);
+            }
+        }
+
+        // Rescans the watches in parallel batches and appends their differences to changes_
+        void pollWatches(const std::vector<std::pair<int, Watch *>> &due, int64_t now, std::vector<int> &gone)
+        {
+            // Paths are spelled here, the polling threads do not touch the arena
+            std::vector<Result> results(due.size());
+            std::vector<std::string> paths(due.size());
+            for (std::size_t i = 0; i < due.size(); ++i)
+            {
+                paths[i] = this->path(*due[i].second);
+            }
+            unsigned threads = static_cast<unsigned>(std::min<std::size_t>(threads_, (due.size() + BATCH_SIZE - 1) / BATCH_SIZE));
+            forEachParallel(due.size(), threads, [&](std::size_t i, std::vector<char> &buffer)
+            {
+                const Watch &watch = *due[i].second;
+                Result &result = results[i];
+                if (watch.directory)
+                {
+                    result.snapshot = DirectorySnapshot::refresh(paths[i], watch.snapshot, buffer);
+                    result.exists = result.snapshot.mtime >= 0;
+                }
+                else
+                {
+                    result.exists = DirectorySnapshot::stat(paths[i], result.state) && result.state.inode == watch.state.inode;
+                }
+            });
+
+            int64_t min_interval = min_interval_.load(std::memory_order_relaxed);
+            int64_t max_interval = max_interval_.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < due.size(); ++i)
+            {
+                auto &[id, watch] = due[i];
+                Result &result = results[i];
+                if (!result.exists)
+                {
+                    gone.push_back(id);
+                    continue;
+                }
+                watch->missing = false;
+
+                std::size_t count = changes_.size();
+                if (watch->directory)
+                {
+                    DirectorySnapshot::diff(watch->snapshot, result.snapshot, [&](std::string_view name, uint32_t mask)
+                    {
+                        if ((mask & IN_MODIFY) && (mask & IN_ISDIR))
+                        {
+                            return; // Changes inside a subdirectory are reported by its own watch
+                        }
+                        const DirectorySnapshot &source = mask & IN_DELETE ? watch->snapshot : result.snapshot;
+                        changes_.push_back(Change{id, mask, std::string(name), source.find(name)->inode});
+                    });
+                    watch->snapshot = std::move(result.snapshot);
+                }
+                else if (result.state.mtime != watch->state.mtime || result.state.size != watch->state.size)
+                {
+                    changes_.push_back(Change{id, IN_MODIFY, {}});
+                    watch->state = result.state;
+                }
+                else if (result.state.mode != watch->state.mode)
+                {
+                    changes_.push_back(Change{id, IN_ATTRIB, {}});
+                    watch->state = result.state;
+                }
+
+                watch->interval = changes_.size() != count ? min_interval : std::min(watch->interval * 2, max_interval);
+                watch->due = now + watch->interval;
+            }
+        }
+
+        void pairRenames()
+        {
+            // Same inode deleted in one place and created in another during this round
+            std::unordered_map<uint64_t, std::size_t> deleted;
+            for (std::size_t i = 0; i < changes_.size(); ++i)
+            {
+                if (changes_[i].mask & IN_DELETE)
+                {
+                    deleted.emplace(changes_[i].inode, i);
+                }
+            }
+            if (deleted.empty())
+            {
+                return;
+            }
+            for (std::size_t i = 0; i < changes_.size(); ++i)
+            {
+                Change &to = changes_[i];
+                auto found = (to.mask & IN_CREATE) ? deleted.find(to.inode) : deleted.end();
+                if (found == deleted.end())
+                {
+                    continue;
+                }
+                Change &from = changes_[found->second];
+                deleted.erase(found);
+                uint32_t directory = to.mask & IN_ISDIR;
+                from.mask = IN_MOVED_FROM | directory;
+                to.mask = IN_MOVED_TO | directory;
+                from.cookie = to.cookie = ++cookie_;
+                from.partner = i;
+                if (directory)
+                {
+                    // Everything watched below the directory moves with its one arena entry
+                    PathArena::Id source = paths_.find(this->path(watches_.at(from.id)) + '/' + from.name);
+                    if (source != PathArena::NONE && paths_.rename(source, watches_.at(to.id).node, to.name))
+                    {
+                        moved_.push_back(source);
+                    }
+                }
+            }
+        }
+
+        void erase(int id)
+        {
+            auto it = watches_.find(id);
+            ids_.erase(it->second.node);
+            paths_.release(it->second.node);
+            watches_.erase(it);
+        }
+
+    public:
+        static constexpr int64_t DEFAULT_MIN_INTERVAL = 250000000;  // 250 ms
+        static constexpr int64_t DEFAULT_MAX_INTERVAL = 4000000000; // 4 s
+
+        explicit PollingBackend(unsigned threads = 1, int64_t min_interval = DEFAULT_MIN_INTERVAL, int64_t max_interval = DEFAULT_MAX_INTERVAL)
+            : threads_(std::max(threads, 1u))
+        {
+            this->setIntervals(min_interval, max_interval);
+            timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (timer_fd_ < 0)
+            {
+                spdlog::error("Failed to create polling timer: {}", std::strerror(errno));
+                throw std::runtime_error("Failed to create polling timer.");
+            }
+        }
+
+        ~PollingBackend() override
+        {
+            close(timer_fd_);
+        }
+
+        PollingBackend(const PollingBackend &) = delete;
+        PollingBackend &operator=(const PollingBackend &) = delete;
+
+        // Nanoseconds between polls of a directory with recent changes and of a quiet one
+        void setIntervals(int64_t min_interval, int64_t max_interval)
+        {
+            min_interval = std::max<int64_t>(min_interval, 1000000);
+            min_interval_ = min_interval;
+            max_interval_ = std::max(max_interval, min_interval);
+        }
+
+        int descriptor() const override { return timer_fd_; }
+
+        int addWatch(const std::filesystem::path &path) override
+        {
+            // The first snapshot is the baseline, nothing is reported for what exists already
+            Watch watch{PathArena::NONE, false, {}, {}, min_interval_, monotonicNanoseconds() + min_interval_};
+            if (!DirectorySnapshot::stat(path.native(), watch.state))
+            {
+                return -1;
+            }
+            watch.directory = watch.state.type == DT_DIR;
+            if (watch.directory)
+            {
+                std::vector<char> buffer;
+                watch.snapshot = DirectorySnapshot::capture(path.native(), buffer);
+            }
+
+            std::lock_guard lock(mutex_);
+            PathArena::Id node = paths_.find(path.native());
+            auto existing = node != PathArena::NONE ? ids_.find(node) : ids_.end();
+            if (existing != ids_.end())
+            {
+                return existing->second; // Like inotify_add_watch(), the same path keeps its id
+            }
+            int id = next_id_++;
+            watch.node = paths_.intern(path.native());
+            ids_.emplace(watch.node, id);
+            int64_t due = watch.due;
+            watches_.emplace(id, std::move(watch));
+            if (due < armed_)
+            {
+                this->arm(due);
+            }
+            return id;
+        }
+
+        int removeWatch(int id) override
+        {
+            std::lock_guard lock(mutex_);
+            if (!watches_.contains(id))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            this->erase(id);
+            return 0;
+        }
+
+        void read(EventSink &sink, std::size_t) override
+        {
+            uint64_t expirations;
+            if (::read(timer_fd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+            {
+                spdlog::error("Failed to read polling timer: {}", std::strerror(errno));
+            }
+
+            int64_t now = monotonicNanoseconds();
+            std::vector<Change> changes;
+            {
+                std::lock_guard lock(mutex_);
+                changes_.clear();
+                this->poll(now);
+                changes.swap(changes_);
+
+                int64_t next = std::numeric_limits<int64_t>::max();
+                for (const auto &[id, watch] : watches_)
+                {
+                    next = std::min(next, watch.due);
+                }
+                armed_ = std::numeric_limits<int64_t>::max();
+                if (next != std::numeric_limits<int64_t>::max())
+                {
+                    this->arm(next);
+                }
+            }
+
+            // Outside the lock, the sink adds watches for new directories
+            for (std::size_t i = 0; i < changes.size(); ++i)
+            {
+                Change &change = changes[i];
+                if (change.mask == 0)
+                {
+                    continue; // Already sent right after its MOVED_FROM
+                }
+                sink.event(EventView{change.id, change.mask, change.cookie, change.name}, now);
+                if (change.partner != SIZE_MAX)
+                {
+                    Change &to = changes[change.partner];
+                    sink.event(EventView{to.id, to.mask, to.cookie, to.name}, now);
+                    to.mask = 0;
+                }
+            }
+        }
+
+        bool coversSubtree() const override { return false; }
+        bool reportsIgnored() const override { return false; }
+        const char *name() const override { return "polling"; }
+    };
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <functional>
+
+namespace inotify
+{
+    // Holds the one coroutine waiting for events. The consumer parks itself with park(), the
+    // producers call wake() after queuing events. The consumer announces itself before its last
+    // look at the queues, a wake() after that leaves a mark and the handle is never published, so
+    // the coroutine is resumed either by park() returning false or by exactly one wake()
+    class AwaitSlot
+    {
+    public:
+        using Resumer = std::function<void(std::coroutine_handle<>)>;
+
+    private:
+        static inline char parking_;                                           // Consumer is checking ready()
+        static inline char woken_;                                             // A wake() came in meanwhile
+
+        std::atomic<void *> waiter_ = nullptr;
+
+    public:
+        // Returns false if ready() is true or a wake() came in, then handle must not be suspended.
+        // Once the handle is published nothing of the awaiter is touched, wake() may already have
+        // resumed and destroyed it
+        template <typename Ready>
+        bool park(std::coroutine_handle<> handle, Ready &&ready)
+        {
+            waiter_.store(&parking_, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready())
+            {
+                waiter_.store(nullptr, std::memory_order_relaxed);
+                return false;
+            }
+            void *expected = &parking_;
+            if (waiter_.compare_exchange_strong(expected, handle.address(), std::memory_order_seq_cst))
+            {
+                return true;
+            }
+            waiter_.store(nullptr, std::memory_order_relaxed);
+            return false;
+        }
+
+        // Resumes the waiting coroutine, through resumer if set (e.g. a post to the consumer's
+        // executor), otherwise right here. Cheap when nobody waits
+        bool wake(const Resumer &resumer)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            void *current = waiter_.load(std::memory_order_relaxed);
+            if (current == nullptr || current == &woken_)
+            {
+                return false;
+            }
+            void *address = waiter_.exchange(&woken_, std::memory_order_seq_cst);
+            if (address == nullptr || address == &woken_ || address == &parking_)
+            {
+                return false;
+            }
+            auto handle = std::coroutine_handle<>::from_address(address);
+            if (resumer)
+            {
+                resumer(handle);
+            }
+            else
+            {
+                handle.resume();
+            }
+            return true;
+        }
+
+        bool waiting() const
+        {
+            void *current = waiter_.load(std::memory_order_relaxed);
+            return current != nullptr && current != &woken_;
+        }
+    };
+}
@@ -0,0 +1,223 @@
+#pragma once
+#include <sys/inotify.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace inotify
+{
+    // Merges bursts of events on the same (wd, name) into one event carrying the union of their masks.
+    // An entry is emitted once no event arrived for it during the quiet window, or at the latest after
+    // max_delay so a file written continuously is still reported. Deadlines are kept in a hashed timer
+    // wheel: a new event only moves the entry's deadline, the entry is re-slotted lazily when its
+    // original slot comes up, so absorbing an event costs one hash lookup and no timer operation.
+    class EventCoalescer
+    {
+    public:
+        // emit(wd, mask, cookie, name, timestamp of the first merged event)
+        using Emit = std::function<void(int, uint32_t, uint32_t, std::string_view, int64_t)>;
+
+        // Events that are never merged: pairing moves needs each cookie, the rest end a watch
+        static constexpr uint32_t PASS_THROUGH = IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                                 IN_UNMOUNT | IN_Q_OVERFLOW | IN_IGNORED;
+
+        // A new directory is not merged either, the caller has to watch it before its content is lost
+        static bool passesThrough(uint32_t mask)
+        {
+            return (mask & PASS_THROUGH) || (mask & (IN_CREATE | IN_ISDIR)) == (IN_CREATE | IN_ISDIR);
+        }
+
+    private:
+        struct Key
+        {
+            int wd;
+            std::string name;
+            bool operator==(const Key &other) const = default;
+        };
+
+        struct KeyHash
+        {
+            std::size_t operator()(const Key &key) const
+            {
+                return std::hash<std::string>{}(key.name) * 31 + static_cast<std::size_t>(key.wd);
+            }
+        };
+
+        struct Entry
+        {
+            uint32_t mask = 0; // 0 once emitted, the entry is then dropped when its slot comes up
+            uint32_t cookie = 0;
+            int64_t first = 0; // Timestamp of the first merged event
+            int64_t last = 0;  // Timestamp of the latest merged event
+        };
+
+        using Map = std::unordered_map<Key, Entry, KeyHash>;
+
+        static constexpr std::size_t WHEEL_SLOTS = 256;
+
+        Map entries_;
+        std::vector<std::vector<Map::value_type *>> wheel_{WHEEL_SLOTS}; // Element pointers survive rehashing, iterators do not
+        int64_t window_;
+        int64_t max_delay_;
+        int64_t tick_;            // Wheel resolution in nanoseconds
+        int64_t current_ = -1;    // Next tick to process, -1 before the first event
+        std::size_t pending_ = 0; // Entries not emitted yet
+
+        int64_t deadline(const Entry &entry) const
+        {
+            return std::min(entry.last + window_, entry.first + max_delay_);
+        }
+
+        void schedule(Map::value_type *item, int64_t earliest)
+        {
+            int64_t tick = std::max(deadline(item->second) / tick_, earliest);
+            wheel_[static_cast<std::size_t>(tick) % WHEEL_SLOTS].push_back(item);
+        }
+
+        void emit(Map::value_type *item, const Emit &output)
+        {
+            output(item->first.wd, item->second.mask, item->second.cookie, item->first.name, item->second.first);
+            item->second.mask = 0;
+            --pending_;
+        }
+
+        void erase(Map::value_type *item)
+        {
+            entries_.erase(entries_.find(item->first));
+        }
+
+        void processSlot(std::size_t slot, int64_t now, const Emit &output)
+        {
+            std::vector<Map::value_type *> due;
+            due.swap(wheel_[slot]);
+            for (Map::value_type *item : due)
+            {
+                if (item->second.mask == 0)
+                {
+                    erase(item);
+                }
+                else if (deadline(item->second) <= now)
+                {
+                    emit(item, output);
+                    erase(item);
+                }
+                else
+                {
+                    schedule(item, current_ + 1);
+                }
+            }
+            due.clear();
+            if (wheel_[slot].empty())
+            {
+                due.swap(wheel_[slot]); // Keep the allocation
+            }
+        }
+
+    public:
+        explicit EventCoalescer(int64_t window_ns, int64_t max_delay_ns = 0)
+            : window_(std::max<int64_t>(window_ns, 1)),
+              max_delay_(max_delay_ns > 0 ? max_delay_ns : 10 * std::max<int64_t>(window_ns, 1)),
+              tick_(std::max<int64_t>(window_ / 8, 1000000)) // 1/8 of the window, at least 1 ms
+        {
+        }
+
+        // Returns false if the event is not merged and has to be delivered as is. Any pending entry
+        // for the same key is emitted first so the order of events on one file is kept
+        bool add(int wd, uint32_t mask, uint32_t cookie, std::string_view name, int64_t timestamp, const Emit &output)
+        {
+            if (current_ < 0)
+            {
+                current_ = timestamp / tick_;
+            }
+            Key key{wd, std::string(name)};
+            auto [it, inserted] = entries_.try_emplace(std::move(key));
+            Entry &entry = it->second;
+
+            if (passesThrough(mask))
+            {
+                if (entry.mask != 0)
+                {
+                    emit(&*it, output);
+                }
+                if (inserted)
+                {
+                    entries_.erase(it);
+                }
+                return false;
+            }
+
+            if (entry.mask == 0)
+            {
+                entry.first = timestamp;
+                entry.cookie = cookie;
+                ++pending_;
+                if (inserted)
+                {
+                    entry.last = timestamp;
+                    entry.mask = mask;
+                    schedule(&*it, current_);
+                    return true;
+                }
+            }
+            entry.mask |= mask;
+            entry.last = timestamp;
+            return true;
+        }
+
+        // Emits every entry whose deadline passed
+        void advance(int64_t now, const Emit &output)
+        {
+            if (current_ < 0)
+            {
+                return;
+            }
+            int64_t target = now / tick_;
+            if (target - current_ >= static_cast<int64_t>(WHEEL_SLOTS))
+            {
+                // Idle for more than a lap, every slot is due once
+                current_ = target - static_cast<int64_t>(WHEEL_SLOTS) + 1;
+            }
+            for (; current_ <= target; ++current_)
+            {
+                processSlot(static_cast<std::size_t>(current_) % WHEEL_SLOTS, now, output);
+            }
+        }
+
+        // Emits everything regardless of deadlines, e.g. when the watcher stops
+        void flush(const Emit &output)
+        {
+            for (auto &item : entries_)
+            {
+                if (item.second.mask != 0)
+                {
+                    emit(&item, output);
+                }
+            }
+            entries_.clear();
+            for (auto &slot : wheel_)
+            {
+                slot.clear();
+            }
+            pending_ = 0;
+        }
+
+        // Milliseconds until the next wheel tick, -1 when nothing is pending (for epoll_wait)
+        int timeout(int64_t now) const
+        {
+            if (pending_ == 0)
+            {
+                return -1;
+            }
+            int64_t remaining = current_ * tick_ - now;
+            return remaining <= 0 ? 0 : static_cast<int>((remaining + 999999) / 1000000);
+        }
+
+        std::size_t size() const { return pending_; }
+        bool empty() const { return pending_ == 0; }
+        int64_t window() const { return window_; }
+    };
+}
@@ -0,0 +1,335 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "file_event.hpp"
+#include "../filter/path_filter.hpp"
+
+namespace inotify
+{
+    // Event as seen by dispatcher handlers, the views are only valid during the call
+    struct EventRef
+    {
+        EventKind kind = EventKind::EVENT;
+        std::string_view path;  // Watched object or entry the event happened on
+        std::string_view from;  // Previous path of a RENAME, empty otherwise
+        uint32_t mask = 0;
+        uint32_t cookie = 0;
+        int64_t timestamp = 0;  // steady_clock nanoseconds
+    };
+
+    // Routes events to handlers registered for a mask and a path pattern. A pattern is either
+    //   - empty, matching every path,
+    //   - a path, matching it and its subtree ("/srv/www"),
+    //   - a glob containing '/', matched against the whole path ("/srv/*/logs/**"),
+    //   - a glob without '/', matched against the last component ("*.conf").
+    // Each mask bit has a bitmap of the handlers registered for it and the literal leading
+    // components of the patterns form a trie, so an event costs one walk down the trie along its
+    // path plus a bit test per handler found there. An event whose mask no handler asked for costs
+    // one atomic load
+    class EventDispatcher
+    {
+    public:
+        using Handler = std::function<void(const EventRef &)>;
+        using HandlerId = uint32_t;
+
+    private:
+        struct Registration
+        {
+            uint32_t mask = 0;        // 0 for a free slot
+            std::string glob;         // Empty for a plain prefix
+            bool name_glob = false;   // glob is matched against the last component
+            uint32_t node = 0;        // Trie node the handler hangs off
+            uint64_t serial = 0;      // Tells a reused id apart from the removed registration
+            Handler handler;
+        };
+
+        struct Node
+        {
+            std::map<std::string, uint32_t, std::less<>> children; // Component -> node
+            std::vector<HandlerId> handlers;
+        };
+
+        std::vector<Registration> handlers_;                 // Indexed by HandlerId
+        std::vector<HandlerId> free_ids_;
+        std::array<std::vector<uint64_t>, 32> mask_bits_;    // Mask bit -> bitmap of HandlerIds
+        std::vector<Node> trie_ = std::vector<Node>(1);      // Node 0 is the root
+        std::atomic<uint32_t> mask_ = 0;                     // Union of all registered masks
+        mutable std::shared_mutex mutex_;
+        uint64_t next_serial_ = 0;
+
+        // remove() called by a handler: the table is locked by the dispatch running it, the removal
+        // is carried out once that dispatch returns
+        std::mutex deferred_mutex_;
+        std::vector<std::pair<HandlerId, uint64_t>> deferred_;   // HandlerId and serial
+        std::atomic<bool> has_deferred_ = false;
+        static inline thread_local const EventDispatcher *dispatching_ = nullptr;
+
+        static bool hasWildcard(std::string_view text)
+        {
+            return text.find_first_of("*?[") != std::string_view::npos;
+        }
+
+        // Calls func(component) for every non-empty component of path
+        template <typename Callable>
+        static void components(std::string_view path, Callable &&func)
+        {
+            while (!path.empty())
+            {
+                std::size_t slash = path.find('/');
+                std::string_view component = path.substr(0, slash);
+                if (!component.empty() && !func(component))
+                {
+                    return;
+                }
+                path.remove_prefix(slash == std::string_view::npos ? path.size() : slash + 1);
+            }
+        }
+
+        void updateMask()
+        {
+            uint32_t mask = 0;
+            for (const Registration &registration : handlers_)
+            {
+                mask |= registration.mask;
+            }
+            mask_.store(mask, std::memory_order_release);
+        }
+
+        bool deferred(HandlerId id)
+        {
+            std::lock_guard lock(deferred_mutex_);
+            return std::any_of(deferred_.begin(), deferred_.end(), [id](const auto &entry) { return entry.first == id; });
+        }
+
+        void erase(HandlerId id)
+        {
+            Registration &registration = handlers_[id];
+            std::erase(trie_[registration.node].handlers, id);
+            for (auto &bitmap : mask_bits_)
+            {
+                if (id / 64 < bitmap.size())
+                {
+                    bitmap[id / 64] &= ~(uint64_t(1) << (id % 64));
+                }
+            }
+            registration = Registration();
+            free_ids_.push_back(id);
+            this->updateMask();
+        }
+
+        void applyDeferred()
+        {
+            std::vector<std::pair<HandlerId, uint64_t>> removals;
+            {
+                std::lock_guard lock(deferred_mutex_);
+                removals.swap(deferred_);
+                has_deferred_.store(false, std::memory_order_relaxed);
+            }
+            std::unique_lock lock(mutex_);
+            for (auto [id, serial] : removals)
+            {
+                // Another remove() may have come first and the id been handed out again
+                if (handlers_[id].mask != 0 && handlers_[id].serial == serial)
+                {
+                    this->erase(id);
+                }
+            }
+        }
+
+        // Handlers below node matching path, candidates is the bitmap selected by the mask
+        template <typename Callable>
+        void visit(uint32_t node, std::string_view path, const std::vector<uint64_t> &candidates, Callable &&func) const
+        {
+            for (HandlerId id : trie_[node].handlers)
+            {
+                if (!(candidates[id / 64] >> (id % 64) & 1))
+                {
+                    continue;
+                }
+                const Registration &registration = handlers_[id];
+                if (!registration.glob.empty())
+                {
+                    std::size_t slash = path.rfind('/');
+                    std::string_view subject = registration.name_glob && slash != std::string_view::npos ? path.substr(slash + 1) : path;
+                    if (!globMatch(registration.glob, subject))
+                    {
+                        continue;
+                    }
+                }
+                func(id);
+            }
+        }
+
+    public:
+        // Registers handler for events with any bit of mask on paths matching pattern
+        HandlerId add(uint32_t mask, std::string_view pattern, Handler handler)
+        {
+            if (mask == 0 || !handler)
+            {
+                throw std::invalid_argument("A handler needs a non-empty mask and a callable.");
+            }
+
+            Registration registration;
+            registration.mask = mask;
+            registration.handler = std::move(handler);
+            std::string_view literal = pattern;
+            if (hasWildcard(pattern))
+            {
+                registration.glob = pattern;
+                registration.name_glob = pattern.find('/') == std::string_view::npos;
+                // Only the components before the first wildcard index the trie
+                std::size_t wildcard = pattern.find_first_of("*?[");
+                std::size_t slash = pattern.rfind('/', wildcard);
+                literal = registration.name_glob || slash == std::string_view::npos ? std::string_view() : pattern.substr(0, slash);
+            }
+
+            std::unique_lock lock(mutex_);
+            uint32_t node = 0;
+            components(literal, [&](std::string_view component)
+            {
+                auto child = trie_[node].children.find(component);
+                if (child == trie_[node].children.end())
+                {
+                    child = trie_[node].children.emplace(std::string(component), static_cast<uint32_t>(trie_.size())).first;
+                    trie_.emplace_back();
+                }
+                node = child->second;
+                return true;
+            });
+            registration.node = node;
+            registration.serial = ++next_serial_;
+
+            HandlerId id;
+            if (!free_ids_.empty())
+            {
+                id = free_ids_.back();
+                free_ids_.pop_back();
+                handlers_[id] = std::move(registration);
+            }
+            else
+            {
+                id = static_cast<HandlerId>(handlers_.size());
+                handlers_.push_back(std::move(registration));
+            }
+            trie_[node].handlers.push_back(id);
+            for (uint32_t bits = mask; bits != 0; bits &= bits - 1)
+            {
+                std::vector<uint64_t> &bitmap = mask_bits_[std::countr_zero(bits)];
+                bitmap.resize(std::max<std::size_t>(bitmap.size(), id / 64 + 1));
+                bitmap[id / 64] |= uint64_t(1) << (id % 64);
+            }
+            this->updateMask();
+            return id;
+        }
+
+        // Returns false if id is not registered. Waits for running handlers to return, except when
+        // called by a handler: then the handler is not called again and is removed once the
+        // dispatch running it returns
+        bool remove(HandlerId id)
+        {
+            if (dispatching_ == this)
+            {
+                // The dispatch on this thread holds the table locked for reading
+                if (id >= handlers_.size() || handlers_[id].mask == 0 || this->deferred(id))
+                {
+                    return false;
+                }
+                std::lock_guard lock(deferred_mutex_);
+                deferred_.emplace_back(id, handlers_[id].serial);
+                has_deferred_.store(true, std::memory_order_relaxed);
+                return true;
+            }
+            std::unique_lock lock(mutex_);
+            if (id >= handlers_.size() || handlers_[id].mask == 0)
+            {
+                return false;
+            }
+            this->erase(id);
+            return true;
+        }
+
+        // Lock-free pre-check: whether any handler could want an event with this mask
+        bool wants(uint32_t mask) const
+        {
+            return (mask & mask_.load(std::memory_order_acquire)) != 0;
+        }
+
+        // Calls every matching handler, shorter prefixes first. A RENAME also matches through its
+        // old path, each handler is called at most once. candidates is scratch space reused
+        // between calls. Handlers run with the table locked for reading, they may call remove()
+        // but not add()
+        void dispatch(const EventRef &event, std::vector<uint64_t> &candidates)
+        {
+            if (!this->wants(event.mask))
+            {
+                return;
+            }
+            std::shared_lock lock(mutex_);
+            struct Scope
+            {
+                const EventDispatcher *outer;
+                ~Scope() { dispatching_ = outer; }
+            } scope{std::exchange(dispatching_, this)};
+            candidates.assign(handlers_.size() / 64 + 1, 0);
+            for (uint32_t bits = event.mask & mask_.load(std::memory_order_relaxed); bits != 0; bits &= bits - 1)
+            {
+                const std::vector<uint64_t> &bitmap = mask_bits_[std::countr_zero(bits)];
+                for (std::size_t i = 0; i < bitmap.size(); ++i)
+                {
+                    candidates[i] |= bitmap[i];
+                }
+            }
+
+            auto call = [&](HandlerId id)
+            {
+                // Clearing the bit keeps the second path of a rename from calling it again
+                candidates[id / 64] &= ~(uint64_t(1) << (id % 64));
+                if (has_deferred_.load(std::memory_order_relaxed) && this->deferred(id))
+                {
+                    return;
+                }
+                handlers_[id].handler(event);
+            };
+            auto walk = [&](std::string_view path)
+            {
+                uint32_t node = 0;
+                this->visit(node, path, candidates, call);
+                components(path, [&](std::string_view component)
+                {
+                    auto child = trie_[node].children.find(component);
+                    if (child == trie_[node].children.end())
+                    {
+                        return false;
+                    }
+                    node = child->second;
+                    this->visit(node, path, candidates, call);
+                    return true;
+                });
+            };
+            walk(event.path);
+            if (!event.from.empty())
+            {
+                walk(event.from);
+            }
+            dispatching_ = scope.outer;
+            lock.unlock();
+            if (has_deferred_.load(std::memory_order_relaxed))
+            {
+                this->applyDeferred();
+            }
+        }
+    };
+}
@@ -0,0 +1,299 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "file_event.hpp"
+
+namespace inotify
+{
+    // One event of an EventBatch, 32 bytes without owned data. Directories are batch-local path ids,
+    // names point into the batch's string pool. A rename's name is "old/new" as in EventRecord
+    struct BatchEvent
+    {
+        int64_t timestamp;       // CLOCK_MONOTONIC nanoseconds when the event was read
+        uint32_t directory;      // Path id of the watched directory (or file) the event was reported on
+        uint32_t from_directory; // For a rename, path id of the directory the entry was moved from
+        uint32_t mask;
+        uint32_t cookie;
+        uint32_t name_offset;
+        uint16_t name_length;
+        EventKind kind;
+        uint8_t shard;
+    };
+    static_assert(sizeof(BatchEvent) == 32 && std::is_trivially_copyable_v<BatchEvent>);
+
+    // A block of events stored column by column. The columns are the structure-of-arrays view a
+    // filter runs over, records() puts them back together as an array of BatchEvent. Each
+    // directory is spelled once per batch into the string pool and referred to by its path id.
+    // clear() keeps every allocation, so a recycled batch fills without touching the allocator
+    class EventBatch
+    {
+    public:
+        static constexpr uint32_t NO_DIRECTORY = UINT32_MAX;
+
+    private:
+        struct Directory
+        {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        struct Slot
+        {
+            uint64_t key = 0;    // Caller's key + 1, 0 marks an empty slot
+            uint32_t id = 0;
+        };
+
+        std::vector<int64_t> timestamps_;
+        std::vector<uint32_t> directories_;
+        std::vector<uint32_t> from_directories_;
+        std::vector<uint32_t> masks_;
+        std::vector<uint32_t> cookies_;
+        std::vector<uint32_t> name_offsets_;
+        std::vector<uint16_t> name_lengths_;
+        std::vector<EventKind> kinds_;
+        std::vector<uint8_t> shards_;
+        std::string pool_;                                 // Names and directory paths, back to back
+        std::vector<Directory> paths_;                     // Path id -> directory in pool_
+        std::vector<Slot> slots_ = std::vector<Slot>(64);  // Caller's directory key -> path id, at most half full
+        std::vector<BatchEvent> records_;                  // Scratch for records()
+
+        std::size_t locate(uint64_t key) const
+        {
+            std::size_t mask = slots_.size() - 1;
+            std::size_t i = static_cast<std::size_t>((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+            while (slots_[i].key != 0 && slots_[i].key != key)
+            {
+                i = (i + 1) & mask;
+            }
+            return i;
+        }
+
+    public:
+        // Path id of the directory known to the caller as key (e.g. shard and wd). The first time
+        // a key is seen spell(std::string &pool) appends its path to the pool
+        template <typename Spell>
+        uint32_t directory(uint64_t key, Spell &&spell)
+        {
+            std::size_t slot = this->locate(++key);
+            if (slots_[slot].key == key)
+            {
+                return slots_[slot].id;
+            }
+            auto offset = static_cast<uint32_t>(pool_.size());
+            spell(pool_);
+            auto id = static_cast<uint32_t>(paths_.size());
+            paths_.push_back(Directory{offset, static_cast<uint32_t>(pool_.size() - offset)});
+            slots_[slot] = Slot{key, id};
+            if (paths_.size() * 2 > slots_.size())
+            {
+                std::vector<Slot> slots(slots_.size() * 2);
+                slots.swap(slots_);
+                for (const Slot &old : slots)
+                {
+                    if (old.key != 0)
+                    {
+                        slots_[this->locate(old.key)] = old;
+                    }
+                }
+            }
+            return id;
+        }
+
+        void add(int64_t timestamp, uint32_t directory, uint32_t mask, uint32_t cookie, std::string_view name,
+                 EventKind kind = EventKind::EVENT, uint32_t from_directory = NO_DIRECTORY, uint8_t shard = 0)
+        {
+            timestamps_.push_back(timestamp);
+            directories_.push_back(directory);
+            from_directories_.push_back(from_directory);
+            masks_.push_back(mask);
+            cookies_.push_back(cookie);
+            name_offsets_.push_back(static_cast<uint32_t>(pool_.size()));
+            name_lengths_.push_back(static_cast<uint16_t>(name.size()));
+            kinds_.push_back(kind);
+            shards_.push_back(shard);
+            pool_.append(name);
+        }
+
+        std::size_t size() const { return masks_.size(); }
+        bool empty() const { return masks_.empty(); }
+
+        // Structure-of-arrays view, one column per field, valid until the next add() or clear()
+        std::span<const int64_t> timestamps() const { return timestamps_; }
+        std::span<const uint32_t> directories() const { return directories_; }
+        std::span<const uint32_t> fromDirectories() const { return from_directories_; }
+        std::span<const uint32_t> masks() const { return masks_; }
+        std::span<const uint32_t> cookies() const { return cookies_; }
+        std::span<const EventKind> kinds() const { return kinds_; }
+        std::span<const uint8_t> shards() const { return shards_; }
+
+        BatchEvent operator[](std::size_t i) const
+        {
+            return BatchEvent{timestamps_[i], directories_[i], from_directories_[i], masks_[i], cookies_[i],
+                              name_offsets_[i], name_lengths_[i], kinds_[i], shards_[i]};
+        }
+
+        // Array-of-structs view, gathered from the columns into a reused buffer
+        std::span<const BatchEvent> records()
+        {
+            records_.resize(this->size());
+            for (std::size_t i = 0; i < records_.size(); ++i)
+            {
+                records_[i] = (*this)[i];
+            }
+            return records_;
+        }
+
+        std::string_view pool() const { return pool_; }
+        std::size_t directoryCount() const { return paths_.size(); }
+
+        std::string_view directoryPath(uint32_t directory) const
+        {
+            return directory < paths_.size() ? std::string_view(pool_).substr(paths_[directory].offset, paths_[directory].length)
+                                             : std::string_view();
+        }
+
+        // Entry name of event i, the new name for a rename
+        std::string_view name(std::size_t i) const
+        {
+            std::string_view name = std::string_view(pool_).substr(name_offsets_[i], name_lengths_[i]);
+            std::size_t separator = kinds_[i] == EventKind::RENAME ? name.find('/') : std::string_view::npos;
+            return separator == std::string_view::npos ? name : name.substr(separator + 1);
+        }
+
+        // Old entry name of a rename, empty otherwise
+        std::string_view fromName(std::size_t i) const
+        {
+            if (kinds_[i] != EventKind::RENAME)
+            {
+                return {};
+            }
+            std::string_view name = std::string_view(pool_).substr(name_offsets_[i], name_lengths_[i]);
+            return name.substr(0, name.find('/'));
+        }
+
+        // Full path of event i into out, spelled like FileEvent::path
+        void path(std::size_t i, std::string &out) const
+        {
+            std::string_view name = this->name(i);
+            out.assign(this->directoryPath(directories_[i]));
+            if (!out.empty() && !name.empty())
+            {
+                out += '/';
+            }
+            out.append(name);
+        }
+
+        // Previous full path of a renamed entry into out, empty otherwise
+        void from(std::size_t i, std::string &out) const
+        {
+            out.clear();
+            if (kinds_[i] == EventKind::RENAME)
+            {
+                out.assign(this->directoryPath(from_directories_[i]));
+                if (!out.empty())
+                {
+                    out += '/';
+                }
+                out.append(this->fromName(i));
+            }
+        }
+
+        FileEvent event(std::size_t i) const
+        {
+            FileEvent event;
+            std::string text;
+            event.kind = kinds_[i];
+            this->path(i, text);
+            event.path = text;
+            this->from(i, text);
+            event.from = std::move(text);
+            event.mask = masks_[i];
+            event.cookie = cookies_[i];
+            event.time = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(timestamps_[i]));
+            return event;
+        }
+
+        // Empties the batch and keeps the capacity of every column
+        void clear()
+        {
+            timestamps_.clear();
+            directories_.clear();
+            from_directories_.clear();
+            masks_.clear();
+            cookies_.clear();
+            name_offsets_.clear();
+            name_lengths_.clear();
+            kinds_.clear();
+            shards_.clear();
+            pool_.clear();
+            paths_.clear();
+            std::fill(slots_.begin(), slots_.end(), Slot());
+            records_.clear();
+        }
+    };
+
+    // Free list of EventBatch. A handle returns its batch, cleared, when it goes out of scope, so
+    // once enough batches are in circulation taking one allocates nothing. Handles keep the pool
+    // alive, create it with std::make_shared. Thread safe
+    class EventBatchPool : public std::enable_shared_from_this<EventBatchPool>
+    {
+    private:
+        struct Recycle
+        {
+            std::shared_ptr<EventBatchPool> pool;
+            void operator()(EventBatch *batch) const { pool->release(batch); }
+        };
+
+        mutable std::mutex mutex_;
+        std::vector<std::unique_ptr<EventBatch>> free_;
+        std::size_t limit_;
+
+        void release(EventBatch *batch)
+        {
+            std::unique_ptr<EventBatch> owned(batch);
+            owned->clear();
+            std::lock_guard lock(mutex_);
+            if (free_.size() < limit_)
+            {
+                free_.push_back(std::move(owned));
+            }
+        }
+
+    public:
+        using Handle = std::unique_ptr<EventBatch, Recycle>;
+
+        // At most limit idle batches are kept, more are freed when they come back
+        explicit EventBatchPool(std::size_t limit = 16) : limit_(limit)
+        {
+            free_.reserve(limit);
+        }
+
+        Handle acquire()
+        {
+            {
+                std::lock_guard lock(mutex_);
+                if (!free_.empty())
+                {
+                    EventBatch *batch = free_.back().release();
+                    free_.pop_back();
+                    return Handle(batch, Recycle{shared_from_this()});
+                }
+            }
+            return Handle(new EventBatch(), Recycle{shared_from_this()});
+        }
+
+        std::size_t idle() const
+        {
+            std::lock_guard lock(mutex_);
+            return free_.size();
+        }
+    };
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string_view>
+
+namespace inotify
+{
+    // Non-owning view of one packed inotify_event record, valid until the next fill()
+    struct EventView
+    {
+        int wd;                // Watch descriptor, -1 for queue overflow
+        uint32_t mask;         // Event mask reported by the kernel
+        uint32_t cookie;       // Cookie pairing IN_MOVED_FROM with IN_MOVED_TO
+        std::string_view name; // Name of the entry inside a watched directory, empty for the watched object itself
+    };
+
+    class EventReader
+    {
+    private:
+        struct AlignedDelete
+        {
+            void operator()(char *ptr) const
+            {
+                ::operator delete[](ptr, std::align_val_t(BUFFER_ALIGNMENT));
+            }
+        };
+
+        std::unique_ptr<char[], AlignedDelete> buffer_;
+        std::size_t capacity_ = 0;
+        std::size_t requested_ = 0; // Size passed to resize(), capacity_ is rounded up from it
+        std::size_t length_ = 0; // Number of valid bytes from the last fill()
+
+    public:
+        static constexpr std::size_t BUFFER_ALIGNMENT = 64;
+        static constexpr std::size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+        static constexpr std::size_t MIN_BUFFER_SIZE = sizeof(struct inotify_event) + NAME_MAX + 1; // Smallest buffer read() accepts for one event
+
+        class iterator
+        {
+        private:
+            const char *ptr_ = nullptr;
+
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = EventView;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = EventView;
+
+            iterator() = default;
+            explicit iterator(const char *ptr) : ptr_(ptr) {}
+
+            EventView operator*() const
+            {
+                const auto *event = reinterpret_cast<const struct inotify_event *>(ptr_);
+                // The kernel pads name with NULs up to len, so the real length has to be measured
+                std::string_view name(event->name, event->len ? strnlen(event->name, event->len) : 0);
+                return EventView{event->wd, event->mask, event->cookie, name};
+            }
+            iterator &operator++()
+            {
+                ptr_ += sizeof(struct inotify_event) + reinterpret_cast<const struct inotify_event *>(ptr_)->len;
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                iterator previous = *this;
+                ++(*this);
+                return previous;
+            }
+            bool operator==(const iterator &other) const { return ptr_ == other.ptr_; }
+        };
+
+        explicit EventReader(std::size_t size = DEFAULT_BUFFER_SIZE)
+        {
+            resize(size);
+        }
+
+        // Replaces the buffer, discarding any events not yet iterated
+        void resize(std::size_t size)
+        {
+            requested_ = size;
+            if (size < MIN_BUFFER_SIZE)
+            {
+                size = MIN_BUFFER_SIZE;
+            }
+            size = (size + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1);
+            buffer_.reset(static_cast<char *>(::operator new[](size, std::align_val_t(BUFFER_ALIGNMENT))));
+            capacity_ = size;
+            length_ = 0;
+        }
+
+        // Reads as many whole events as fit into the buffer with one read() call.
+        // Returns the number of bytes read, 0 when the descriptor has nothing left, -1 on error (errno is kept)
+        ssize_t fill(int fd)
+        {
+            ssize_t length;
+            do
+            {
+                length = read(fd, buffer_.get(), capacity_);
+            } while (length < 0 && errno == EINTR);
+
+            if (length < 0)
+            {
+                length_ = 0;
+                return errno == EAGAIN ? 0 : -1;
+            }
+            length_ = static_cast<std::size_t>(length);
+            return length;
+        }
+
+        std::size_t capacity() const { return capacity_; }
+        std::size_t requested() const { return requested_; } // Compare a new size against this, not capacity()
+        std::size_t size() const { return length_; }
+        const char *data() const { return buffer_.get(); } // Raw bytes of the last fill(), for other record formats
+        char *data() { return buffer_.get(); }             // Target of a read issued elsewhere, see assign()
+
+        // Takes length bytes that a read issued elsewhere (io_uring) placed at data()
+        void assign(std::size_t length)
+        {
+            length_ = std::min(length, capacity_);
+        }
+        bool empty() const { return length_ == 0; }
+
+        iterator begin() const { return iterator(buffer_.get()); }
+        iterator end() const { return iterator(buffer_.get() + length_); }
+    };
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <sys/inotify.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <utility>
+
+namespace inotify
+{
+    enum class EventKind : uint8_t
+    {
+        EVENT,  // Event as reported by the kernel, possibly coalesced
+        RENAME, // IN_MOVED_FROM and IN_MOVED_TO paired by cookie, from holds the old path
+        OVERFLOW // The kernel queue overflowed, events synthesized by the rescan follow
+    };
+
+    // Event as handed to users of Watcher::getCurrentEvents(), with the path already resolved
+    struct FileEvent
+    {
+        EventKind kind = EventKind::EVENT;
+        std::filesystem::path path;                 // Watched object or entry the event happened on
+        std::filesystem::path from;                 // Previous path of a renamed entry
+        uint32_t mask = 0;                          // Event mask, see InotifyMask
+        uint32_t cookie = 0;                        // Cookie pairing IN_MOVED_FROM with IN_MOVED_TO
+        std::chrono::steady_clock::time_point time; // When the event was read from the kernel
+    };
+
+    inline int64_t monotonicNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Names of the mask bits in the order of bits/mask.ixx followed by the kernel and special flags
+    inline constexpr std::array<std::pair<uint32_t, const char *>, 18> MASK_NAMES = {{
+        {IN_ACCESS, "ACCESS"},
+        {IN_MODIFY, "MODIFY"},
+        {IN_ATTRIB, "ATTRIB"},
+        {IN_CLOSE_WRITE, "CLOSE_WRITE"},
+        {IN_CLOSE_NOWRITE, "CLOSE_NOWRITE"},
+        {IN_OPEN, "OPEN"},
+        {IN_MOVED_FROM, "MOVED_FROM"},
+        {IN_MOVED_TO, "MOVED_TO"},
+        {IN_CREATE, "CREATE"},
+        {IN_DELETE, "DELETE"},
+        {IN_DELETE_SELF, "DELETE_SELF"},
+        {IN_MOVE_SELF, "MOVE_SELF"},
+        {IN_UNMOUNT, "UNMOUNT"},
+        {IN_Q_OVERFLOW, "OVERFLOW"},
+        {IN_IGNORED, "IGNORED"},
+        {IN_ISDIR, "ISDIR"},
+        {IN_ONESHOT, "ONESHOT"},
+        {IN_EXCL_UNLINK, "EXCL_UNLINK"},
+    }};
+
+    // Formats a mask as "MODIFY|CLOSE_WRITE"
+    inline std::string maskToString(uint32_t mask)
+    {
+        std::string result;
+        for (const auto &[bit, name] : MASK_NAMES)
+        {
+            if (mask & bit)
+            {
+                if (!result.empty())
+                {
+                    result += '|';
+                }
+                result += name;
+            }
+        }
+        return result;
+    }
+
+    inline std::ostream &operator<<(std::ostream &out, const FileEvent &event)
+    {
+        if (event.kind == EventKind::RENAME)
+        {
+            out << event.from.string() << " -> ";
+        }
+        return out << event.path.string() << ' ' << maskToString(event.mask);
+    }
+}
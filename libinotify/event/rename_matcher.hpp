@@ -0,0 +1,93 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace inotify
+{
+    // Pairs IN_MOVED_FROM with the IN_MOVED_TO carrying the same cookie. The kernel queues both halves
+    // of a rename back to back, so a MOVED_FROM still unmatched after the window was a move out of the
+    // watched tree. Pending entries are few and kept in arrival order, which is also expiry order.
+    class RenameMatcher
+    {
+    public:
+        struct Pending
+        {
+            int wd;
+            uint32_t mask;
+            uint32_t cookie;
+            std::string name;
+            int64_t timestamp;
+        };
+
+        static constexpr int64_t DEFAULT_WINDOW = 20000000; // 20 ms
+
+    private:
+        std::vector<Pending> pending_;
+        int64_t window_;
+
+    public:
+        explicit RenameMatcher(int64_t window_ns = DEFAULT_WINDOW) : window_(window_ns) {}
+
+        void from(int wd, uint32_t mask, uint32_t cookie, std::string_view name, int64_t timestamp)
+        {
+            pending_.push_back(Pending{wd, mask, cookie, std::string(name), timestamp});
+        }
+
+        // The MOVED_FROM half for cookie, if it is still pending
+        std::optional<Pending> take(uint32_t cookie)
+        {
+            auto it = std::find_if(pending_.begin(), pending_.end(), [cookie](const Pending &item) { return item.cookie == cookie; });
+            if (it == pending_.end())
+            {
+                return std::nullopt;
+            }
+            std::optional<Pending> result(std::move(*it));
+            pending_.erase(it);
+            return result;
+        }
+
+        // Calls func(Pending &&) for every MOVED_FROM older than the window
+        template <typename Callable>
+        void expire(int64_t now, Callable &&func)
+        {
+            std::size_t count = 0;
+            while (count < pending_.size() && pending_[count].timestamp + window_ <= now)
+            {
+                ++count;
+            }
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                func(std::move(pending_[i]));
+            }
+            pending_.erase(pending_.begin(), pending_.begin() + count);
+        }
+
+        template <typename Callable>
+        void flush(Callable &&func)
+        {
+            for (Pending &item : pending_)
+            {
+                func(std::move(item));
+            }
+            pending_.clear();
+        }
+
+        // Milliseconds until the oldest MOVED_FROM expires, -1 when nothing is pending (for epoll_wait)
+        int timeout(int64_t now) const
+        {
+            if (pending_.empty())
+            {
+                return -1;
+            }
+            int64_t remaining = pending_.front().timestamp + window_ - now;
+            return remaining <= 0 ? 0 : static_cast<int>((remaining + 999999) / 1000000);
+        }
+
+        void setWindow(int64_t window_ns) { window_ = window_ns; }
+        bool empty() const { return pending_.empty(); }
+    };
+}
@@ -0,0 +1,294 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "../queue/spsc_ring.hpp"
+
+namespace inotify
+{
+    // Counters of a WorkerPool, summed over its threads when read
+    struct WorkerPoolStats
+    {
+        static constexpr std::size_t BUCKETS = 40;
+
+        std::size_t queue_depth = 0;                      // Tasks submitted but not started
+        std::size_t max_queue_depth = 0;                  // Highest queue_depth seen
+        uint64_t executed = 0;                            // Tasks finished
+        uint64_t wait_total = 0;                          // Nanoseconds between submit() and start, summed
+        uint64_t wait_max = 0;
+        uint64_t run_total = 0;                           // Nanoseconds spent running tasks, summed
+        uint64_t run_max = 0;
+        std::array<uint64_t, BUCKETS> run_histogram = {}; // Bucket i counts run times in [2^i, 2^(i+1)) ns
+    };
+
+    // Fixed-size pool running tasks concurrently, except that tasks submitted with keys mapping to the
+    // same lane run one after the other in submission order. A lane with work is queued on one worker;
+    // a worker with nothing queued steals lanes from the others. Each lane runs on one worker at a time,
+    // at most LANE_BATCH tasks before it goes to the back of the queue, so a busy key cannot starve others
+    template <typename Task>
+    class WorkerPool
+    {
+    public:
+        using Run = std::function<void(Task &)>;
+        static constexpr std::size_t LANE_BATCH = 64;
+
+    private:
+        struct Item
+        {
+            Task task;
+            int64_t submitted; // steady_clock nanoseconds
+        };
+
+        struct alignas(CACHE_LINE_SIZE) Lane
+        {
+            std::mutex mutex;
+            std::deque<Item> items;
+            bool scheduled = false; // Queued on a worker or running, guarded by mutex
+        };
+
+        struct alignas(CACHE_LINE_SIZE) Worker
+        {
+            std::mutex mutex;
+            std::deque<std::size_t> ready; // Lanes with work, guarded by mutex
+            std::thread thread;
+
+            std::atomic<uint64_t> executed = 0;
+            std::atomic<uint64_t> wait_total = 0;
+            std::atomic<uint64_t> wait_max = 0;
+            std::atomic<uint64_t> run_total = 0;
+            std::atomic<uint64_t> run_max = 0;
+            std::array<std::atomic<uint64_t>, WorkerPoolStats::BUCKETS> run_histogram = {};
+        };
+
+        Run run_;
+        std::unique_ptr<Lane[]> lanes_;
+        std::size_t lane_count_;
+        std::vector<std::unique_ptr<Worker>> workers_;
+
+        std::mutex sleep_mutex_;
+        std::condition_variable wake_;
+        long ready_ = 0;    // Lanes queued on all workers, guarded by sleep_mutex_
+        bool stop_ = false; // Guarded by sleep_mutex_
+
+        std::atomic<std::size_t> depth_ = 0;
+        std::atomic<std::size_t> max_depth_ = 0;
+
+        static int64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        template <typename T>
+        static void raise(std::atomic<T> &maximum, T value)
+        {
+            T current = maximum.load(std::memory_order_relaxed);
+            while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        void schedule(std::size_t lane, std::size_t worker)
+        {
+            {
+                std::lock_guard lock(workers_[worker]->mutex);
+                workers_[worker]->ready.push_back(lane);
+            }
+            {
+                std::lock_guard lock(sleep_mutex_);
+                ++ready_;
+            }
+            wake_.notify_one();
+        }
+
+        // Own queue from the front, other workers' queues from the back
+        bool take(std::size_t worker, std::size_t &lane)
+        {
+            for (std::size_t i = 0; i < workers_.size(); ++i)
+            {
+                Worker &victim = *workers_[(worker + i) % workers_.size()];
+                std::lock_guard lock(victim.mutex);
+                if (victim.ready.empty())
+                {
+                    continue;
+                }
+                if (i == 0)
+                {
+                    lane = victim.ready.front();
+                    victim.ready.pop_front();
+                }
+                else
+                {
+                    lane = victim.ready.back();
+                    victim.ready.pop_back();
+                }
+                std::lock_guard sleepLock(sleep_mutex_);
+                --ready_;
+                return true;
+            }
+            return false;
+        }
+
+        void drain(std::size_t worker, std::size_t index)
+        {
+            Worker &self = *workers_[worker];
+            Lane &lane = lanes_[index];
+            for (std::size_t i = 0; i < LANE_BATCH; ++i)
+            {
+                Item item;
+                {
+                    std::lock_guard lock(lane.mutex);
+                    if (lane.items.empty())
+                    {
+                        lane.scheduled = false;
+                        return;
+                    }
+                    item = std::move(lane.items.front());
+                    lane.items.pop_front();
+                }
+                depth_.fetch_sub(1, std::memory_order_relaxed);
+
+                int64_t start = now();
+                try
+                {
+                    run_(item.task);
+                }
+                catch (const std::exception &ex)
+                {
+                    spdlog::error("Event handler failed: {}", ex.what());
+                }
+                catch (...)
+                {
+                    spdlog::error("Event handler failed with an unknown exception");
+                }
+                int64_t end = now();
+
+                uint64_t wait = static_cast<uint64_t>(std::max<int64_t>(start - item.submitted, 0));
+                uint64_t run = static_cast<uint64_t>(std::max<int64_t>(end - start, 0));
+                self.executed.fetch_add(1, std::memory_order_relaxed);
+                self.wait_total.fetch_add(wait, std::memory_order_relaxed);
+                self.run_total.fetch_add(run, std::memory_order_relaxed);
+                raise(self.wait_max, wait);
+                raise(self.run_max, run);
+                std::size_t bucket = std::min<std::size_t>(std::bit_width(run | 1) - 1, WorkerPoolStats::BUCKETS - 1);
+                self.run_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+            }
+            // Still scheduled, give the other lanes of this worker a turn first
+            this->schedule(index, worker);
+        }
+
+        void work(std::size_t worker)
+        {
+            while (true)
+            {
+                std::size_t lane;
+                if (this->take(worker, lane))
+                {
+                    this->drain(worker, lane);
+                    continue;
+                }
+                std::unique_lock lock(sleep_mutex_);
+                wake_.wait(lock, [this]()
+                {
+                    return ready_ > 0 || stop_;
+                });
+                if (stop_ && ready_ <= 0)
+                {
+                    return;
+                }
+            }
+        }
+
+    public:
+        // lanes bounds the parallelism between keys, a multiple of threads spreads them evenly
+        WorkerPool(unsigned threads, std::size_t lanes, Run run)
+            : run_(std::move(run)), lanes_(std::make_unique<Lane[]>(std::max<std::size_t>(lanes, 1))),
+              lane_count_(std::max<std::size_t>(lanes, 1))
+        {
+            threads = std::max(threads, 1u);
+            for (unsigned i = 0; i < threads; ++i)
+            {
+                workers_.push_back(std::make_unique<Worker>());
+            }
+            for (unsigned i = 0; i < threads; ++i)
+            {
+                workers_[i]->thread = std::thread([this, i]()
+                {
+                    this->work(i);
+                });
+            }
+        }
+
+        // Runs the tasks still queued, then stops the threads
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard lock(sleep_mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            for (auto &worker : workers_)
+            {
+                worker->thread.join();
+            }
+        }
+
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator=(const WorkerPool &) = delete;
+
+        // Tasks with equal keys run in the order they were submitted
+        void submit(uint64_t key, Task &&task)
+        {
+            std::size_t index = key % lane_count_;
+            Lane &lane = lanes_[index];
+            bool idle;
+            {
+                std::lock_guard lock(lane.mutex);
+                lane.items.push_back(Item{std::move(task), now()});
+                idle = !lane.scheduled;
+                lane.scheduled = true;
+            }
+            raise(max_depth_, depth_.fetch_add(1, std::memory_order_relaxed) + 1);
+            if (idle)
+            {
+                this->schedule(index, index % workers_.size());
+            }
+        }
+
+        std::size_t depth() const { return depth_.load(std::memory_order_relaxed); }
+        unsigned threads() const { return static_cast<unsigned>(workers_.size()); }
+        std::size_t lanes() const { return lane_count_; }
+
+        WorkerPoolStats stats() const
+        {
+            WorkerPoolStats stats;
+            stats.queue_depth = depth_.load(std::memory_order_relaxed);
+            stats.max_queue_depth = max_depth_.load(std::memory_order_relaxed);
+            for (const auto &worker : workers_)
+            {
+                stats.executed += worker->executed.load(std::memory_order_relaxed);
+                stats.wait_total += worker->wait_total.load(std::memory_order_relaxed);
+                stats.wait_max = std::max(stats.wait_max, worker->wait_max.load(std::memory_order_relaxed));
+                stats.run_total += worker->run_total.load(std::memory_order_relaxed);
+                stats.run_max = std::max(stats.run_max, worker->run_max.load(std::memory_order_relaxed));
+                for (std::size_t i = 0; i < WorkerPoolStats::BUCKETS; ++i)
+                {
+                    stats.run_histogram[i] += worker->run_histogram[i].load(std::memory_order_relaxed);
+                }
+            }
+            return stats;
+        }
+    };
+}
@@ -0,0 +1,292 @@
+#pragma once
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <spdlog/spdlog.h>
+
+namespace inotify
+{
+    struct WalkEntry
+    {
+        std::string path;   // Absolute or root-relative path of the entry
+        unsigned char type; // DT_DIR, DT_REG, ... as reported by getdents64
+        int depth;          // 0 for the root
+    };
+
+    // Parallel tree walker used to register watches. Directories are read with openat()/getdents64()
+    // and classified by d_type, so no stat is needed unless the filesystem reports DT_UNKNOWN.
+    // Every worker owns a deque of pending directories, takes work from its back and steals from the
+    // front of the others when it runs dry, and sleeps on an atomic wait while there is nothing to
+    // steal. Symbolic links are reported but never followed.
+    class DirectoryWalker
+    {
+    public:
+        // Return false to skip an entry; for a directory this prunes the whole subtree
+        using Filter = std::function<bool(std::string_view path, unsigned char type)>;
+
+    private:
+        struct Task
+        {
+            std::string path;
+            int depth;
+        };
+
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            std::vector<WalkEntry> entries;
+        };
+
+        struct LinuxDirent64
+        {
+            ino64_t d_ino;
+            off64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[1]; // NUL-terminated, runs on to d_reclen, read through name()
+        };
+
+        static const char *name(const LinuxDirent64 *dirent)
+        {
+            return reinterpret_cast<const char *>(dirent) + offsetof(LinuxDirent64, d_name);
+        }
+
+        unsigned threads_;
+        int max_depth_;
+        bool include_files_ = false;
+        Filter filter_;
+
+        static constexpr std::size_t DIRENT_BUFFER_SIZE = 32 * 1024;
+
+        bool steal(std::vector<std::unique_ptr<Worker>> &workers, std::size_t self, Task &task)
+        {
+            {
+                std::lock_guard lock(workers[self]->mutex);
+                if (!workers[self]->tasks.empty())
+                {
+                    task = std::move(workers[self]->tasks.back());
+                    workers[self]->tasks.pop_back();
+                    return true;
+                }
+            }
+            for (std::size_t i = 1; i < workers.size(); ++i)
+            {
+                Worker &victim = *workers[(self + i) % workers.size()];
+                std::lock_guard lock(victim.mutex);
+                if (!victim.tasks.empty())
+                {
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void scan(const Task &task, Worker &worker, std::atomic<std::size_t> &pending, std::atomic<uint32_t> &epoch, std::vector<char> &buffer)
+        {
+            std::vector<Task> children;
+            readDirectory(task.path, buffer, [&](std::string_view name, unsigned char type)
+            {
+                if (type != DT_DIR && !include_files_)
+                {
+                    return;
+                }
+
+                std::string path = task.path;
+                if (path.back() != '/')
+                {
+                    path += '/';
+                }
+                path += name;
+                if (filter_ && !filter_(path, type))
+                {
+                    return;
+                }
+
+                if (type == DT_DIR && (max_depth_ < 0 || task.depth + 1 < max_depth_))
+                {
+                    children.push_back(Task{path, task.depth + 1});
+                }
+                worker.entries.push_back(WalkEntry{std::move(path), type, task.depth + 1});
+            });
+
+            if (!children.empty())
+            {
+                pending.fetch_add(children.size(), std::memory_order_relaxed);
+                {
+                    std::lock_guard lock(worker.mutex);
+                    for (Task &child : children)
+                    {
+                        worker.tasks.push_back(std::move(child));
+                    }
+                }
+                epoch.fetch_add(1, std::memory_order_release);
+                epoch.notify_all();
+            }
+        }
+
+    public:
+        explicit DirectoryWalker(unsigned threads = std::thread::hardware_concurrency(), int max_depth = -1)
+            : threads_(std::max(threads, 1u)), max_depth_(max_depth)
+        {
+        }
+
+        // Lists one directory with getdents64(), calling func(std::string_view name, unsigned char type)
+        // for every entry but "." and "..". buffer is scratch space reused between calls
+        template <typename Callable>
+        static bool readDirectory(const std::string &path, std::vector<char> &buffer, Callable &&func)
+        {
+            int fd = openat(AT_FDCWD, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                spdlog::warn("Failed to open directory {}: {}", path, std::strerror(errno));
+                return false;
+            }
+            bool result = readDirectory(fd, path, buffer, std::forward<Callable>(func));
+            close(fd);
+            return result;
+        }
+
+        // Same for a directory already open as fd, which stays open. path is only used in messages.
+        // Without resolve_unknown, DT_UNKNOWN is passed on instead of calling fstatat() per entry
+        template <typename Callable>
+        static bool readDirectory(int fd, const std::string &path, std::vector<char> &buffer, Callable &&func, bool resolve_unknown = true)
+        {
+            if (buffer.size() < DIRENT_BUFFER_SIZE)
+            {
+                buffer.resize(DIRENT_BUFFER_SIZE);
+            }
+
+            bool result = true;
+            while (true)
+            {
+                long length = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+                if (length <= 0)
+                {
+                    if (length < 0)
+                    {
+                        spdlog::warn("Failed to read directory {}: {}", path, std::strerror(errno));
+                        result = false;
+                    }
+                    break;
+                }
+                for (long offset = 0; offset < length;)
+                {
+                    const auto *dirent = reinterpret_cast<const LinuxDirent64 *>(buffer.data() + offset);
+                    offset += dirent->d_reclen;
+
+                    std::string_view name(DirectoryWalker::name(dirent));
+                    if (name == "." || name == "..")
+                    {
+                        continue;
+                    }
+
+                    unsigned char type = dirent->d_type;
+                    if (type == DT_UNKNOWN && resolve_unknown)
+                    {
+                        struct stat info;
+                        if (fstatat(fd, name.data(), &info, AT_SYMLINK_NOFOLLOW) == 0)
+                        {
+                            type = IFTODT(info.st_mode);
+                        }
+                    }
+                    func(name, type);
+                }
+            }
+            return result;
+        }
+
+        void setThreads(unsigned threads) { threads_ = std::max(threads, 1u); }
+        unsigned getThreads() const { return threads_; }
+        void setMaxDepth(int depth) { max_depth_ = depth; } // Deepest level reported, -1 for unlimited, 0 for the root only
+        int getMaxDepth() const { return max_depth_; }
+        void setIncludeFiles(bool value) { include_files_ = value; }
+        void setFilter(Filter filter) { filter_ = std::move(filter); }
+
+        // Returns the root followed by every entry below it, in no particular order.
+        // The filter is called concurrently from the worker threads
+        std::vector<WalkEntry> walk(const std::filesystem::path &root)
+        {
+            std::vector<std::unique_ptr<Worker>> workers;
+            for (unsigned i = 0; i < threads_; ++i)
+            {
+                workers.push_back(std::make_unique<Worker>());
+            }
+
+            std::atomic<std::size_t> pending = 1; // Directories queued or being scanned
+            std::atomic<uint32_t> epoch = 0;      // Bumped when tasks are queued or the walk ends
+            workers[0]->tasks.push_back(Task{root.string(), 0});
+
+            auto run = [&](std::size_t self)
+            {
+                std::vector<char> buffer(DIRENT_BUFFER_SIZE);
+                Task task;
+                while (pending.load(std::memory_order_acquire) != 0)
+                {
+                    // Read before looking for work, so tasks queued meanwhile end the wait right away
+                    uint32_t seen = epoch.load(std::memory_order_acquire);
+                    if (!steal(workers, self, task))
+                    {
+                        if (pending.load(std::memory_order_acquire) != 0)
+                        {
+                            epoch.wait(seen, std::memory_order_acquire);
+                        }
+                        continue;
+                    }
+                    if (max_depth_ < 0 || task.depth < max_depth_)
+                    {
+                        scan(task, *workers[self], pending, epoch, buffer);
+                    }
+                    if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        epoch.fetch_add(1, std::memory_order_release);
+                        epoch.notify_all();
+                    }
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for (unsigned i = 1; i < threads_; ++i)
+            {
+                pool.emplace_back(run, i);
+            }
+            run(0);
+            for (std::thread &thread : pool)
+            {
+                thread.join();
+            }
+
+            std::size_t total = 1;
+            for (const auto &worker : workers)
+            {
+                total += worker->entries.size();
+            }
+            std::vector<WalkEntry> result;
+            result.reserve(total);
+            result.push_back(WalkEntry{root.string(), DT_DIR, 0});
+            for (auto &worker : workers)
+            {
+                std::move(worker->entries.begin(), worker->entries.end(), std::back_inserter(result));
+            }
+            return result;
+        }
+    };
+}
@@ -10,7 +10,6 @@ namespace inotify
     {
     private:
         std::filesystem::path root_;
-        std::vector<std::filesystem::path> absolutePaths_;
 
     public:
         FileSystem() : root_(std::filesystem::current_path()) {}
@@ -0,0 +1,274 @@
+#pragma once
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <string_view>
+#include <vector>
+#include "directory_walker.hpp"
+
+namespace inotify
+{
+    // State of one directory entry as far as change detection is concerned
+    struct EntryState
+    {
+        uint64_t inode = 0;
+        int64_t mtime = 0; // Nanoseconds since the epoch
+        uint64_t size = 0;
+        uint32_t mode = 0; // Type and permission bits
+        unsigned char type = DT_UNKNOWN;
+
+        bool operator==(const EntryState &other) const = default;
+    };
+
+    // Cached listing of a watched directory, compared against the current state to synthesize the
+    // events lost when the kernel queue overflowed. Entries are kept sorted by name in one vector with
+    // their names back to back in one string, about 40 bytes plus the name per entry, and two
+    // snapshots are compared in a single merge
+    struct DirectorySnapshot
+    {
+        struct Entry
+        {
+            uint32_t name_offset;
+            uint32_t name_length;
+            EntryState state;
+        };
+
+        int64_t mtime = -1; // Of the directory itself, changes whenever an entry is added, removed or renamed
+        std::vector<Entry> entries;
+        std::string names;
+        std::size_t garbage = 0; // Bytes of names no entry points to any more, left by update()
+
+        std::string_view name(const Entry &entry) const
+        {
+            return std::string_view(names).substr(entry.name_offset, entry.name_length);
+        }
+
+        // State of the entry called name, nullptr if there is none
+        const EntryState *find(std::string_view name) const
+        {
+            auto it = std::lower_bound(entries.begin(), entries.end(), name, [this](const Entry &entry, std::string_view key)
+            {
+                return this->name(entry) < key;
+            });
+            return it != entries.end() && this->name(*it) == name ? &it->state : nullptr;
+        }
+
+        std::size_t size() const { return entries.size(); }
+
+        // Brings the entry called name up to date after an event reported it, directory being the
+        // path of the listed directory. It is stat'ed again, added if new and dropped if gone, so a
+        // later diff() does not report the same change a second time
+        void update(const std::string &directory, std::string_view name)
+        {
+            std::string child = directory;
+            child += '/';
+            child += name;
+            EntryState state;
+            bool exists = stat(child, state);
+            auto it = std::lower_bound(entries.begin(), entries.end(), name, [this](const Entry &entry, std::string_view key)
+            {
+                return this->name(entry) < key;
+            });
+            bool found = it != entries.end() && this->name(*it) == name;
+            if (found && exists)
+            {
+                it->state = state;
+            }
+            else if (found)
+            {
+                garbage += it->name_length;
+                entries.erase(it);
+            }
+            else if (exists)
+            {
+                entries.insert(it, Entry{static_cast<uint32_t>(names.size()), static_cast<uint32_t>(name.size()), state});
+                names += name;
+            }
+
+            if (garbage > 4096 && garbage * 2 > names.size())
+            {
+                std::string compacted;
+                compacted.reserve(names.size() - garbage);
+                for (Entry &entry : entries)
+                {
+                    uint32_t offset = static_cast<uint32_t>(compacted.size());
+                    compacted.append(names, entry.name_offset, entry.name_length);
+                    entry.name_offset = offset;
+                }
+                names = std::move(compacted);
+                garbage = 0;
+            }
+        }
+
+        static int64_t nanoseconds(const struct timespec &time)
+        {
+            return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+        }
+
+        static int64_t nanoseconds(const struct statx_timestamp &time)
+        {
+            return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+        }
+
+        // Fills state from statx() without following a symbolic link, false if path is gone
+        static bool stat(const std::string &path, EntryState &state)
+        {
+            struct statx info;
+            if (statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_INO | STATX_MTIME | STATX_SIZE, &info) != 0)
+            {
+                return false;
+            }
+            state.inode = info.stx_ino;
+            state.mtime = nanoseconds(info.stx_mtime);
+            state.size = info.stx_size;
+            state.mode = info.stx_mode;
+            state.type = IFTODT(info.stx_mode);
+            return true;
+        }
+
+        // Modification time of the directory, -1 if it can no longer be stat'ed
+        static int64_t directoryTime(const std::string &path)
+        {
+            struct stat info;
+            return ::stat(path.c_str(), &info) == 0 ? nanoseconds(info.st_mtim) : -1;
+        }
+
+        // Lists path and stats every entry. buffer is getdents64 scratch space reused between calls
+        static DirectorySnapshot capture(const std::string &path, std::vector<char> &buffer)
+        {
+            DirectorySnapshot snapshot;
+            snapshot.mtime = directoryTime(path);
+            if (snapshot.mtime < 0)
+            {
+                return snapshot;
+            }
+            std::string child = path;
+            child += '/';
+            std::size_t base = child.size();
+            DirectoryWalker::readDirectory(path, buffer, [&](std::string_view name, unsigned char)
+            {
+                child.resize(base);
+                child += name;
+                EntryState state;
+                if (stat(child, state))
+                {
+                    snapshot.entries.push_back(Entry{static_cast<uint32_t>(snapshot.names.size()), static_cast<uint32_t>(name.size()), state});
+                    snapshot.names += name;
+                }
+            });
+            std::sort(snapshot.entries.begin(), snapshot.entries.end(), [&snapshot](const Entry &a, const Entry &b)
+            {
+                return snapshot.name(a) < snapshot.name(b);
+            });
+            return snapshot;
+        }
+
+        // Like capture(), but while the modification time of the directory is unchanged no entry was
+        // added or removed, so the cached names are only stat'ed again instead of listing the directory
+        static DirectorySnapshot refresh(const std::string &path, const DirectorySnapshot &before, std::vector<char> &buffer)
+        {
+            int64_t mtime = directoryTime(path);
+            if (mtime < 0 || mtime != before.mtime)
+            {
+                return capture(path, buffer);
+            }
+            DirectorySnapshot snapshot;
+            snapshot.mtime = mtime;
+            snapshot.entries = before.entries;
+            snapshot.names = before.names;
+            std::string child = path;
+            child += '/';
+            std::size_t base = child.size();
+            for (Entry &entry : snapshot.entries)
+            {
+                child.resize(base);
+                child += snapshot.name(entry);
+                if (!stat(child, entry.state))
+                {
+                    return capture(path, buffer); // Removed within the timestamp granularity
+                }
+            }
+            return snapshot;
+        }
+
+        // Calls func(std::string_view name, uint32_t mask) for every difference from before to after:
+        // CREATE for new entries, DELETE for vanished ones, both for a replaced inode, MODIFY for a
+        // changed size or modification time and ATTRIB for changed permissions. IN_ISDIR is added for
+        // directories. All DELETEs come first, then the CREATEs
+        template <typename Callable>
+        static void diff(const DirectorySnapshot &before, const DirectorySnapshot &after, Callable &&func)
+        {
+            auto b = before.entries.begin();
+            auto a = after.entries.begin();
+            std::vector<const Entry *> created;
+            while (b != before.entries.end() || a != after.entries.end())
+            {
+                int order = b == before.entries.end() ? 1 : a == after.entries.end() ? -1 : before.name(*b).compare(after.name(*a));
+                if (order < 0)
+                {
+                    func(before.name(*b), IN_DELETE | (b->state.type == DT_DIR ? IN_ISDIR : 0));
+                    ++b;
+                    continue;
+                }
+                if (order > 0)
+                {
+                    created.push_back(&*a);
+                    ++a;
+                    continue;
+                }
+                uint32_t directory = b->state.type == DT_DIR ? IN_ISDIR : 0;
+                if (a->state.inode != b->state.inode)
+                {
+                    func(before.name(*b), IN_DELETE | directory);
+                    created.push_back(&*a);
+                }
+                else if (a->state.mtime != b->state.mtime || a->state.size != b->state.size)
+                {
+                    func(before.name(*b), IN_MODIFY | directory);
+                }
+                else if (a->state.mode != b->state.mode)
+                {
+                    func(before.name(*b), IN_ATTRIB | directory);
+                }
+                ++b;
+                ++a;
+            }
+            for (const Entry *entry : created)
+            {
+                func(after.name(*entry), IN_CREATE | (entry->state.type == DT_DIR ? IN_ISDIR : 0));
+            }
+        }
+    };
+
+    // Runs func(std::size_t index, std::vector<char> &buffer) for every index below count on up to
+    // threads threads. Each thread owns one getdents64 scratch buffer
+    template <typename Callable>
+    void forEachParallel(std::size_t count, unsigned threads, Callable &&func)
+    {
+        std::atomic<std::size_t> next = 0;
+        auto run = [&]()
+        {
+            std::vector<char> buffer;
+            for (std::size_t i = next++; i < count; i = next++)
+            {
+                func(i, buffer);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < std::min<std::size_t>(std::max(threads, 1u), count); ++i)
+        {
+            pool.emplace_back(run);
+        }
+        run();
+        for (std::thread &thread : pool)
+        {
+            thread.join();
+        }
+    }
+}
@@ -0,0 +1,177 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LIBINOTIFY_X86 1
+#endif
+
+#include "../event/event_batch.hpp"
+
+namespace inotify
+{
+    // Selects events by mask bits, see InotifyMask and InotifySpecialFlags. An event passes when it has
+    // at least one bit of any (or any is 0), every bit of all and no bit of none. For example
+    // {IN_CREATE | IN_DELETE, 0, IN_ISDIR} keeps files being created or deleted
+    struct MaskPredicate
+    {
+        uint32_t any = 0;
+        uint32_t all = 0;
+        uint32_t none = 0;
+
+        // Evaluated without short-circuit so that compilers emit no branches
+        bool matches(uint32_t mask) const
+        {
+            return ((any == 0) | ((mask & any) != 0)) & ((mask & all) == all) & ((mask & none) == 0);
+        }
+    };
+
+    enum class SimdLevel
+    {
+        SCALAR, // Branch-free loop, any CPU
+        SSE2,   // 4 masks per step
+        AVX2    // 8 masks per step, compacted with a permutation table
+    };
+
+    namespace detail
+    {
+        // Masks from begin to count, the SIMD kernels finish their tail here
+        inline std::size_t selectScalar(const uint32_t *masks, std::size_t begin, std::size_t count, MaskPredicate predicate, uint32_t *selection)
+        {
+            // The index is always written and the cursor only advances on a match, no branch to mispredict
+            std::size_t selected = 0;
+            for (std::size_t i = begin; i < count; ++i)
+            {
+                selection[selected] = static_cast<uint32_t>(i);
+                selected += predicate.matches(masks[i]);
+            }
+            return selected;
+        }
+
+#ifdef LIBINOTIFY_X86
+        __attribute__((target("sse2"))) inline std::size_t selectSse2(const uint32_t *masks, std::size_t count, MaskPredicate predicate, uint32_t *selection)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i any = _mm_set1_epi32(static_cast<int>(predicate.any));
+            const __m128i all = _mm_set1_epi32(static_cast<int>(predicate.all));
+            const __m128i none = _mm_set1_epi32(static_cast<int>(predicate.none));
+            const __m128i any_off = predicate.any == 0 ? _mm_set1_epi32(-1) : zero;
+            // Without a variable shuffle in SSE2 the four lanes are written like the scalar loop does
+            std::size_t selected = 0;
+            std::size_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(masks + i));
+                __m128i has_any = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(mask, any), zero), _mm_set1_epi32(-1)), any_off);
+                __m128i has_all = _mm_cmpeq_epi32(_mm_and_si128(mask, all), all);
+                __m128i has_none = _mm_cmpeq_epi32(_mm_and_si128(mask, none), zero);
+                auto bits = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(_mm_and_si128(has_any, has_all), has_none))));
+                for (unsigned lane = 0; lane < 4; ++lane)
+                {
+                    selection[selected] = static_cast<uint32_t>(i + lane);
+                    selected += (bits >> lane) & 1;
+                }
+            }
+            return selected + selectScalar(masks, i, count, predicate, selection + selected);
+        }
+
+        // Lane order of each 8-bit match mask with the matching lanes first, one byte per lane
+        inline constexpr std::array<uint64_t, 256> COMPACT_LANES = []()
+        {
+            std::array<uint64_t, 256> table = {};
+            for (unsigned bits = 0; bits < 256; ++bits)
+            {
+                uint64_t lanes = 0;
+                unsigned position = 0;
+                for (unsigned lane = 0; lane < 8; ++lane)
+                {
+                    if (bits & (1u << lane))
+                    {
+                        lanes |= uint64_t(lane) << (8 * position++);
+                    }
+                }
+                table[bits] = lanes;
+            }
+            return table;
+        }();
+
+        __attribute__((target("avx2"))) inline std::size_t selectAvx2(const uint32_t *masks, std::size_t count, MaskPredicate predicate, uint32_t *selection)
+        {
+            // Each step stores 8 indexes and advances by the number that matched, which never writes
+            // past selection[count - 1] since at most i indexes were kept before step i
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i ones = _mm256_set1_epi32(-1);
+            const __m256i any = _mm256_set1_epi32(static_cast<int>(predicate.any));
+            const __m256i all = _mm256_set1_epi32(static_cast<int>(predicate.all));
+            const __m256i none = _mm256_set1_epi32(static_cast<int>(predicate.none));
+            const __m256i any_off = predicate.any == 0 ? ones : zero;
+            const __m256i step = _mm256_set1_epi32(8);
+            __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            std::size_t selected = 0;
+            std::size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks + i));
+                __m256i has_any = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(mask, any), zero), ones), any_off);
+                __m256i has_all = _mm256_cmpeq_epi32(_mm256_and_si256(mask, all), all);
+                __m256i has_none = _mm256_cmpeq_epi32(_mm256_and_si256(mask, none), zero);
+                auto bits = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(_mm256_and_si256(has_any, has_all), has_none))));
+                __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(&COMPACT_LANES[bits])));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(selection + selected), _mm256_permutevar8x32_epi32(index, lanes));
+                selected += std::popcount(bits);
+                index = _mm256_add_epi32(index, step);
+            }
+            return selected + selectScalar(masks, i, count, predicate, selection + selected);
+        }
+#endif
+    }
+
+    // Best level the CPU running the process supports, detected once
+    inline SimdLevel detectSimdLevel()
+    {
+#ifdef LIBINOTIFY_X86
+        static const SimdLevel level = []()
+        {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : __builtin_cpu_supports("sse2") ? SimdLevel::SSE2 : SimdLevel::SCALAR;
+        }();
+        return level;
+#else
+        return SimdLevel::SCALAR;
+#endif
+    }
+
+    // Writes the indexes of the masks that match predicate to selection, in order, and returns how
+    // many there are. selection must have room for count indexes. A level the CPU lacks falls back
+    // to the best one it has
+    inline std::size_t selectMasks(const uint32_t *masks, std::size_t count, MaskPredicate predicate, uint32_t *selection,
+                                   SimdLevel level = detectSimdLevel())
+    {
+#ifdef LIBINOTIFY_X86
+        level = std::min(level, detectSimdLevel());
+        if (level == SimdLevel::AVX2)
+        {
+            return detail::selectAvx2(masks, count, predicate, selection);
+        }
+        if (level == SimdLevel::SSE2)
+        {
+            return detail::selectSse2(masks, count, predicate, selection);
+        }
+#endif
+        return detail::selectScalar(masks, 0, count, predicate, selection);
+    }
+
+    // Selection vector of the events of batch that match predicate. Reusing selection across batches
+    // keeps it from allocating once it has grown to the batch size
+    inline void selectEvents(const EventBatch &batch, MaskPredicate predicate, std::vector<uint32_t> &selection,
+                             SimdLevel level = detectSimdLevel())
+    {
+        selection.resize(batch.size());
+        selection.resize(selectMasks(batch.masks().data(), batch.size(), predicate, selection.data(), level));
+    }
+}
@@ -0,0 +1,546 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace inotify
+{
+    // Matches a glob against text. '*' and '?' do not cross '/', '**' does, [...] is a character class
+    inline bool globMatch(std::string_view pattern, std::string_view text)
+    {
+        std::size_t p = 0, t = 0;
+        std::size_t star_p = std::string_view::npos, star_t = 0; // Backtrack point of the last single '*'
+        while (t < text.size())
+        {
+            if (p + 1 < pattern.size() && pattern[p] == '*' && pattern[p + 1] == '*')
+            {
+                std::string_view rest = pattern.substr(p + 2);
+                if (!rest.empty() && rest.front() == '/')
+                {
+                    // "**/" also matches zero directories
+                    if (globMatch(rest.substr(1), text.substr(t)))
+                    {
+                        return true;
+                    }
+                }
+                for (std::size_t i = t; i <= text.size(); ++i)
+                {
+                    if (globMatch(rest, text.substr(i)))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            if (p < pattern.size() && pattern[p] == '*')
+            {
+                star_p = p++;
+                star_t = t;
+                continue;
+            }
+            std::size_t class_end = p < pattern.size() && pattern[p] == '[' ? pattern.find(']', p + 2) : std::string_view::npos;
+            if (class_end != std::string_view::npos)
+            {
+                bool negate = pattern[p + 1] == '!' || pattern[p + 1] == '^';
+                bool found = false;
+                for (std::size_t i = p + 1 + negate; i < class_end; ++i)
+                {
+                    if (i + 2 < class_end && pattern[i + 1] == '-')
+                    {
+                        found |= pattern[i] <= text[t] && text[t] <= pattern[i + 2];
+                        i += 2;
+                    }
+                    else
+                    {
+                        found |= pattern[i] == text[t];
+                    }
+                }
+                if (found != negate && text[t] != '/')
+                {
+                    p = class_end + 1;
+                    ++t;
+                    continue;
+                }
+            }
+            else if (p < pattern.size() && (pattern[p] == text[t] || (pattern[p] == '?' && text[t] != '/')))
+            {
+                ++p;
+                ++t;
+                continue;
+            }
+            if (star_p != std::string_view::npos && text[star_t] != '/')
+            {
+                p = star_p + 1;
+                t = ++star_t;
+                continue;
+            }
+            return false;
+        }
+        while (p < pattern.size() && pattern[p] == '*')
+        {
+            ++p;
+        }
+        return p == pattern.size();
+    }
+
+    // Set of include/exclude patterns compiled for fast matching of many paths.
+    // Globs are sorted by shape into literal indexes: exact names, name suffixes ("*.swp"),
+    // name prefixes ("core.*"), directory names ("**/node_modules/**"), exact paths and path
+    // prefixes ("/srv/cache/**"). Each index costs one hash lookup per distinct literal length, only
+    // globs of any other shape are matched one by one. POSIX extended regular expressions are split
+    // at their top-level '|' and every alternative made of a literal and leading or trailing ".*"
+    // ("/srv/cache/.*", ".*\.swp$", ".*~.*") goes into the same indexes. Only the alternatives left
+    // over are joined into one std::regex, so most filters never run the backtracking matcher.
+    //
+    // A pattern matching a directory excludes its subtree. During traversal the subtree is pruned, so
+    // excluded() only tests the last path component against name patterns; excludedAnywhere() tests
+    // every component and is meant for paths that were not obtained through a filtered traversal.
+    class PathFilter
+    {
+    private:
+        struct StringHash
+        {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view value) const { return std::hash<std::string_view>{}(value); }
+        };
+        using StringSet = std::unordered_set<std::string, StringHash, std::equal_to<>>;
+
+        struct LiteralIndex
+        {
+            StringSet names;                    // Whole component
+            StringSet name_suffixes;            // "*lit"
+            StringSet name_prefixes;            // "lit*"
+            StringSet paths;                    // Whole path, also matches its subtree
+            StringSet path_prefixes;            // "lit.*" regex, raw prefix of the whole path
+            StringSet path_suffixes;            // ".*lit" regex with '/' in lit
+            std::vector<std::string> path_substrings; // ".*lit.*" regex
+            std::vector<std::size_t> suffix_lengths;
+            std::vector<std::size_t> prefix_lengths;
+            std::vector<std::size_t> path_prefix_lengths;
+            std::vector<std::size_t> path_suffix_lengths;
+            std::vector<std::string> name_globs; // Any other glob without '/'
+            std::vector<std::string> path_globs; // Any other glob with '/'
+            bool empty = true;
+
+            static void addLength(std::vector<std::size_t> &lengths, std::size_t length)
+            {
+                if (std::find(lengths.begin(), lengths.end(), length) == lengths.end())
+                {
+                    lengths.push_back(length);
+                }
+            }
+
+            static bool hasWildcard(std::string_view text)
+            {
+                return text.find_first_of("*?[") != std::string_view::npos;
+            }
+
+            void add(std::string glob)
+            {
+                empty = false;
+                // "**/x" anchors nowhere, which is how a pattern without '/' behaves anyway
+                while (glob.starts_with("**/"))
+                {
+                    glob.erase(0, 3);
+                }
+                // "x/**" matches x and everything below it, which every pattern already implies
+                bool subtree = false;
+                while (glob.size() > 3 && glob.ends_with("/**"))
+                {
+                    glob.resize(glob.size() - 3);
+                    subtree = true;
+                }
+                while (glob.size() > 1 && glob.back() == '/')
+                {
+                    glob.pop_back();
+                }
+
+                if (glob.find('/') == std::string::npos)
+                {
+                    std::string_view body(glob);
+                    if (!hasWildcard(body))
+                    {
+                        names.insert(glob);
+                    }
+                    else if (body.front() == '*' && !hasWildcard(body.substr(1)))
+                    {
+                        name_suffixes.emplace(body.substr(1));
+                        addLength(suffix_lengths, body.size() - 1);
+                    }
+                    else if (body.back() == '*' && !hasWildcard(body.substr(0, body.size() - 1)))
+                    {
+                        name_prefixes.emplace(body.substr(0, body.size() - 1));
+                        addLength(prefix_lengths, body.size() - 1);
+                    }
+                    else
+                    {
+                        name_globs.push_back(glob);
+                    }
+                }
+                else if (!hasWildcard(glob))
+                {
+                    paths.insert(glob);
+                }
+                else
+                {
+                    path_globs.push_back(subtree ? glob + "/**" : glob);
+                    if (subtree)
+                    {
+                        path_globs.push_back(glob);
+                    }
+                }
+            }
+
+            // Regex alternative compiled by literalShape(). A literal without '/' after ".*" only
+            // reaches into the last component, so it is kept with the name suffixes
+            void addRegexLiteral(std::string literal, bool leading_any, bool trailing_any)
+            {
+                empty = false;
+                if (leading_any && trailing_any)
+                {
+                    path_substrings.push_back(std::move(literal));
+                }
+                else if (trailing_any)
+                {
+                    addLength(path_prefix_lengths, literal.size());
+                    path_prefixes.insert(std::move(literal));
+                }
+                else if (leading_any && literal.find('/') == std::string::npos)
+                {
+                    addLength(suffix_lengths, literal.size());
+                    name_suffixes.insert(std::move(literal));
+                }
+                else if (leading_any)
+                {
+                    addLength(path_suffix_lengths, literal.size());
+                    path_suffixes.insert(std::move(literal));
+                }
+                else
+                {
+                    paths.insert(std::move(literal));
+                }
+            }
+
+            bool matchName(std::string_view name) const
+            {
+                if (names.find(name) != names.end())
+                {
+                    return true;
+                }
+                for (std::size_t length : suffix_lengths)
+                {
+                    if (name.size() >= length && name_suffixes.find(name.substr(name.size() - length)) != name_suffixes.end())
+                    {
+                        return true;
+                    }
+                }
+                for (std::size_t length : prefix_lengths)
+                {
+                    if (name.size() >= length && name_prefixes.find(name.substr(0, length)) != name_prefixes.end())
+                    {
+                        return true;
+                    }
+                }
+                for (const std::string &glob : name_globs)
+                {
+                    if (globMatch(glob, name))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            bool matchPath(std::string_view path, bool all_components) const
+            {
+                if (empty)
+                {
+                    return false;
+                }
+                std::size_t slash = path.rfind('/');
+                std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+                if (matchName(name))
+                {
+                    return true;
+                }
+                if (!paths.empty())
+                {
+                    // The path itself or any of its ancestors
+                    for (std::size_t end = path.size(); end != 0 && end != std::string_view::npos; end = path.rfind('/', end - 1))
+                    {
+                        if (paths.find(path.substr(0, end)) != paths.end())
+                        {
+                            return true;
+                        }
+                    }
+                }
+                for (std::size_t length : path_prefix_lengths)
+                {
+                    if (path.size() >= length && path_prefixes.find(path.substr(0, length)) != path_prefixes.end())
+                    {
+                        return true;
+                    }
+                }
+                if (!path_suffixes.empty())
+                {
+                    // Like paths, an ancestor ending in the literal excludes what lies below it
+                    for (std::size_t end = path.size(); end != 0 && end != std::string_view::npos; end = all_components ? path.rfind('/', end - 1) : 0)
+                    {
+                        for (std::size_t length : path_suffix_lengths)
+                        {
+                            if (end >= length && path_suffixes.find(path.substr(end - length, length)) != path_suffixes.end())
+                            {
+                                return true;
+                            }
+                        }
+                    }
+                }
+                for (const std::string &literal : path_substrings)
+                {
+                    if (path.find(literal) != std::string_view::npos)
+                    {
+                        return true;
+                    }
+                }
+                for (const std::string &glob : path_globs)
+                {
+                    if (globMatch(glob, path))
+                    {
+                        return true;
+                    }
+                }
+                if (all_components)
+                {
+                    for (std::size_t begin = 0, end; begin < path.size(); begin = end + 1)
+                    {
+                        end = path.find('/', begin);
+                        if (end == std::string_view::npos || end == path.size())
+                        {
+                            break; // The last component was tested above
+                        }
+                        if (end > begin && matchName(path.substr(begin, end - begin)))
+                        {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            }
+        };
+
+        struct RegexSet
+        {
+            std::vector<std::string> patterns;
+            std::regex compiled;
+
+            void add(const std::string &pattern, std::regex::flag_type flags)
+            {
+                patterns.push_back(pattern);
+                std::string joined;
+                for (const std::string &item : patterns)
+                {
+                    joined += joined.empty() ? "(" : "|(";
+                    joined += item;
+                    joined += ')';
+                }
+                compiled.assign(joined, flags | std::regex::nosubs | std::regex::optimize);
+            }
+
+            bool match(std::string_view path) const
+            {
+                return !patterns.empty() && std::regex_match(path.begin(), path.end(), compiled);
+            }
+        };
+
+        LiteralIndex excludes_;
+        LiteralIndex excludes_icase_;
+        LiteralIndex includes_;
+        RegexSet regex_;
+        RegexSet regex_icase_;
+
+        // Splits an extended regular expression at the '|' outside groups and bracket expressions
+        static std::vector<std::string_view> alternatives(std::string_view pattern)
+        {
+            std::vector<std::string_view> result;
+            std::size_t begin = 0;
+            int depth = 0;
+            for (std::size_t i = 0; i < pattern.size(); ++i)
+            {
+                if (pattern[i] == '\\')
+                {
+                    ++i;
+                }
+                else if (pattern[i] == '[')
+                {
+                    // ']' right after '[' or "[^" belongs to the set
+                    i = pattern.find(']', i + (i + 1 < pattern.size() && pattern[i + 1] == '^' ? 3 : 2));
+                    if (i == std::string_view::npos)
+                    {
+                        break;
+                    }
+                }
+                else if (pattern[i] == '(')
+                {
+                    ++depth;
+                }
+                else if (pattern[i] == ')')
+                {
+                    --depth;
+                }
+                else if (pattern[i] == '|' && depth == 0)
+                {
+                    result.push_back(pattern.substr(begin, i - begin));
+                    begin = i + 1;
+                }
+            }
+            result.push_back(pattern.substr(begin));
+            return result;
+        }
+
+        // Whether an alternative is a single literal with optional ".*" before and after it, and
+        // optional anchors (regex_match anchors anyway). False for anything else, which stays a regex
+        static bool literalShape(std::string_view pattern, std::string &literal, bool &leading_any, bool &trailing_any)
+        {
+            literal.clear();
+            if (pattern.starts_with('^'))
+            {
+                pattern.remove_prefix(1);
+            }
+            if (pattern.ends_with('$') && !pattern.ends_with("\\$"))
+            {
+                pattern.remove_suffix(1);
+            }
+            leading_any = pattern.starts_with(".*");
+            if (leading_any)
+            {
+                pattern.remove_prefix(2);
+            }
+            trailing_any = pattern.ends_with(".*") && !pattern.ends_with("\\.*");
+            if (trailing_any)
+            {
+                pattern.remove_suffix(2);
+            }
+            for (std::size_t i = 0; i < pattern.size(); ++i)
+            {
+                char c = pattern[i];
+                if (c == '\\')
+                {
+                    // Only escaped special characters are literals, "\\w" and friends are not ERE
+                    if (++i == pattern.size() || std::string_view(".[]{}()*+?^$|\\/").find(pattern[i]) == std::string_view::npos)
+                    {
+                        return false;
+                    }
+                    literal += pattern[i];
+                }
+                else if (std::string_view(".[]{}()*+?^$|").find(c) != std::string_view::npos)
+                {
+                    return false;
+                }
+                else
+                {
+                    literal += c;
+                }
+            }
+            return !literal.empty();
+        }
+
+        static std::string lower(std::string_view text)
+        {
+            std::string result(text);
+            std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return std::tolower(c); });
+            return result;
+        }
+
+        bool excludedImpl(std::string_view path, bool directory, bool all_components) const
+        {
+            if (excludes_.matchPath(path, all_components) || regex_.match(path) || regex_icase_.match(path))
+            {
+                return true;
+            }
+            if (!excludes_icase_.empty)
+            {
+                thread_local std::string lowered; // Scratch buffer, the filter is queried from walker threads
+                lowered.assign(path);
+                std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return std::tolower(c); });
+                if (excludes_icase_.matchPath(lowered, all_components))
+                {
+                    return true;
+                }
+            }
+            // Includes only restrict files, directories are always descended into
+            return !directory && !includes_.empty && !includes_.matchPath(path, false);
+        }
+
+    public:
+        // Glob exclude such as "*.swp", "**/node_modules/**" or "/srv/cache/**"
+        void excludeGlob(const std::string &glob, bool icase = false)
+        {
+            if (icase)
+            {
+                excludes_icase_.add(lower(glob));
+            }
+            else
+            {
+                excludes_.add(glob);
+            }
+        }
+
+        // Glob that files must match to pass, once any include is set
+        void includeGlob(const std::string &glob)
+        {
+            includes_.add(glob);
+        }
+
+        // POSIX extended regular expression matched against the whole path, throws std::regex_error
+        void excludeRegex(const std::string &pattern, bool icase = false)
+        {
+            std::regex::flag_type flags = icase ? std::regex::extended | std::regex::icase : std::regex::extended;
+            std::regex(pattern, flags); // Throws for an invalid pattern before anything is changed
+
+            std::string literal;
+            bool leading_any, trailing_any;
+            for (std::string_view alternative : alternatives(pattern))
+            {
+                if (!literalShape(alternative, literal, leading_any, trailing_any))
+                {
+                    (icase ? regex_icase_ : regex_).add(std::string(alternative), flags);
+                }
+                else if (icase)
+                {
+                    excludes_icase_.addRegexLiteral(lower(literal), leading_any, trailing_any);
+                }
+                else
+                {
+                    excludes_.addRegexLiteral(std::move(literal), leading_any, trailing_any);
+                }
+            }
+        }
+
+        // Exact path, excludes its subtree as well
+        void excludePath(const std::string &path)
+        {
+            excludes_.empty = false;
+            excludes_.paths.insert(path);
+        }
+
+        bool excluded(std::string_view path, bool directory = false) const
+        {
+            return excludedImpl(path, directory, false);
+        }
+
+        bool excludedAnywhere(std::string_view path, bool directory = false) const
+        {
+            return excludedImpl(path, directory, true);
+        }
+
+        bool empty() const
+        {
+            return excludes_.empty && excludes_icase_.empty && includes_.empty && regex_.patterns.empty() && regex_icase_.patterns.empty();
+        }
+    };
+}
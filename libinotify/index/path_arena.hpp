@@ -0,0 +1,339 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace inotify
+{
+    // Interns paths as chains of (parent, name) entries, every directory is stored once no matter
+    // how many paths run through it. Entries are 16 bytes in one vector, names live back to back in
+    // one string, and a flat open-addressing table maps (parent, name) to the 32-bit id. Full paths
+    // are only put together when asked for, by walking the parent chain. Entries are reference
+    // counted: intern() and retain() add a reference, every child holds one on its parent, and an
+    // entry whose count drops to zero is recycled. Renaming a directory rewrites a single entry and
+    // moves everything below it. Not thread safe
+    class PathArena
+    {
+    public:
+        using Id = uint32_t;
+        static constexpr Id NONE = UINT32_MAX;
+        static constexpr Id ROOT = 0;      // "/", where absolute paths start
+        static constexpr Id RELATIVE = 1;  // "", where relative paths start
+
+    private:
+        struct Entry
+        {
+            Id parent = NONE;              // NONE for the two roots and recycled entries
+            uint32_t name_offset = 0;
+            uint32_t name_length = 0;
+            uint32_t references = 0;       // Children plus retain() calls
+        };
+
+        struct Slot
+        {
+            Id id = NONE;
+            uint32_t hash = 0;
+        };
+
+        std::vector<Entry> entries_;
+        std::string names_;
+        std::vector<Slot> slots_;          // Power of two, at most half full
+        std::vector<Id> free_;             // Recycled ids
+        std::size_t used_ = 0;             // Occupied slots
+        std::size_t garbage_ = 0;          // Bytes of names_ no entry points to any more
+
+        static uint32_t hash(Id parent, std::string_view name)
+        {
+            uint64_t value = std::hash<std::string_view>{}(name) ^ (uint64_t(parent) * 0x9e3779b97f4a7c15ull);
+            return static_cast<uint32_t>((value * 0x9e3779b97f4a7c15ull) >> 32);
+        }
+
+        // Slot holding (parent, name), or the empty slot where it would go
+        std::size_t locate(Id parent, std::string_view name, uint32_t key) const
+        {
+            std::size_t mask = slots_.size() - 1;
+            std::size_t i = key & mask;
+            while (slots_[i].id != NONE && !(slots_[i].hash == key && entries_[slots_[i].id].parent == parent && this->name(slots_[i].id) == name))
+            {
+                i = (i + 1) & mask;
+            }
+            return i;
+        }
+
+        void link(Id id)
+        {
+            uint32_t key = hash(entries_[id].parent, this->name(id));
+            slots_[this->locate(entries_[id].parent, this->name(id), key)] = Slot{id, key};
+            if (++used_ * 2 > slots_.size())
+            {
+                std::vector<Slot> slots(slots_.size() * 2);
+                std::size_t mask = slots.size() - 1;
+                for (const Slot &slot : slots_)
+                {
+                    if (slot.id == NONE)
+                    {
+                        continue;
+                    }
+                    std::size_t i = slot.hash & mask;
+                    while (slots[i].id != NONE)
+                    {
+                        i = (i + 1) & mask;
+                    }
+                    slots[i] = slot;
+                }
+                slots_ = std::move(slots);
+            }
+        }
+
+        // Removes id from the table, nothing if another entry took its (parent, name) over.
+        // Backward-shift deletion keeps probe sequences intact without tombstones
+        void unlink(Id id)
+        {
+            std::size_t mask = slots_.size() - 1;
+            std::size_t hole = hash(entries_[id].parent, this->name(id)) & mask;
+            while (slots_[hole].id != id)
+            {
+                if (slots_[hole].id == NONE)
+                {
+                    return;
+                }
+                hole = (hole + 1) & mask;
+            }
+            for (std::size_t i = (hole + 1) & mask; slots_[i].id != NONE; i = (i + 1) & mask)
+            {
+                if (((i - slots_[i].hash) & mask) >= ((i - hole) & mask))
+                {
+                    slots_[hole] = slots_[i];
+                    hole = i;
+                }
+            }
+            slots_[hole] = Slot();
+            --used_;
+        }
+
+        uint32_t store(std::string_view name)
+        {
+            if (garbage_ > 4096 && garbage_ * 2 > names_.size())
+            {
+                this->compact();
+            }
+            auto offset = static_cast<uint32_t>(names_.size());
+            names_.append(name);
+            return offset;
+        }
+
+        // Rewrites names_ with the names still in use, after renames and releases left holes
+        void compact()
+        {
+            std::string names;
+            names.reserve(names_.size() - garbage_);
+            for (Entry &entry : entries_)
+            {
+                uint32_t offset = static_cast<uint32_t>(names.size());
+                names.append(names_, entry.name_offset, entry.name_length);
+                entry.name_offset = offset;
+            }
+            names_ = std::move(names);
+            garbage_ = 0;
+        }
+
+        Id create(Id parent, std::string_view name)
+        {
+            Id id;
+            if (free_.empty())
+            {
+                id = static_cast<Id>(entries_.size());
+                entries_.emplace_back();
+            }
+            else
+            {
+                id = free_.back();
+                free_.pop_back();
+            }
+            entries_[id] = Entry{parent, this->store(name), static_cast<uint32_t>(name.size()), 0};
+            ++entries_[parent].references;
+            this->link(id);
+            return id;
+        }
+
+        // Calls func(std::string_view component) for the non-empty components of path
+        template <typename Callable>
+        static bool components(std::string_view path, Callable &&func)
+        {
+            while (!path.empty())
+            {
+                std::size_t slash = path.find('/');
+                std::string_view component = path.substr(0, slash);
+                if (!component.empty() && !func(component))
+                {
+                    return false;
+                }
+                path.remove_prefix(slash == std::string_view::npos ? path.size() : slash + 1);
+            }
+            return true;
+        }
+
+    public:
+        PathArena()
+        {
+            this->clear();
+        }
+
+        // Id of path with one reference for the caller, creating the missing entries. Empty
+        // components are skipped, "/a//b/" is the same path as "/a/b"
+        Id intern(std::string_view path)
+        {
+            Id id = !path.empty() && path.front() == '/' ? ROOT : RELATIVE;
+            components(path, [&](std::string_view name)
+            {
+                std::size_t slot = this->locate(id, name, hash(id, name));
+                id = slots_[slot].id != NONE ? slots_[slot].id : this->create(id, name);
+                return true;
+            });
+            ++entries_[id].references;
+            return id;
+        }
+
+        // Id of path if it was interned, NONE otherwise. Adds no reference
+        Id find(std::string_view path) const
+        {
+            Id id = !path.empty() && path.front() == '/' ? ROOT : RELATIVE;
+            components(path, [&](std::string_view name)
+            {
+                id = slots_[this->locate(id, name, hash(id, name))].id;
+                return id != NONE;
+            });
+            return id;
+        }
+
+        void retain(Id id)
+        {
+            ++entries_[id].references;
+        }
+
+        // Drops a reference, recycling the entry and then its unreferenced parents
+        void release(Id id)
+        {
+            while (id > RELATIVE && --entries_[id].references == 0)
+            {
+                Id parent = entries_[id].parent;
+                this->unlink(id);
+                garbage_ += entries_[id].name_length;
+                entries_[id] = Entry();
+                free_.push_back(id);
+                id = parent;
+            }
+        }
+
+        // Moves id to name below parent, with everything below it. An entry already interned at
+        // the destination is detached: it keeps its references and still spells its old path, but
+        // find() no longer returns it. False if parent lies below id
+        bool rename(Id id, Id parent, std::string_view name)
+        {
+            if (id <= RELATIVE || this->within(parent, id))
+            {
+                return false;
+            }
+            std::size_t slot = this->locate(parent, name, hash(parent, name));
+            if (slots_[slot].id == id)
+            {
+                return true;
+            }
+            if (slots_[slot].id != NONE)
+            {
+                this->unlink(slots_[slot].id);
+            }
+            this->unlink(id);
+            Id old_parent = entries_[id].parent;
+            ++entries_[parent].references;
+            garbage_ += entries_[id].name_length;
+            entries_[id].parent = parent;
+            entries_[id].name_offset = this->store(name);
+            entries_[id].name_length = static_cast<uint32_t>(name.size());
+            this->link(id);
+            this->release(old_parent);
+            return true;
+        }
+
+        // Whether id is ancestor or lies below it
+        bool within(Id id, Id ancestor) const
+        {
+            for (; id != NONE; id = entries_[id].parent)
+            {
+                if (id == ancestor)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        Id parent(Id id) const { return entries_[id].parent; }
+        std::string_view name(Id id) const { return std::string_view(names_).substr(entries_[id].name_offset, entries_[id].name_length); }
+
+        // Appends the full path of id, sized first and then filled from the back
+        void append(Id id, std::string &out) const
+        {
+            std::size_t length = 0;
+            Id top = id;
+            for (; entries_[top].parent != NONE; top = entries_[top].parent)
+            {
+                length += entries_[top].name_length + 1;
+            }
+            if (top == RELATIVE && length > 0)
+            {
+                --length; // No leading '/'
+            }
+            else if (top == ROOT && length == 0)
+            {
+                length = 1; // "/"
+            }
+            std::size_t begin = out.size();
+            std::size_t end = begin + length;
+            out.resize(end);
+            for (; entries_[id].parent != NONE; id = entries_[id].parent)
+            {
+                std::string_view component = this->name(id);
+                end -= component.size();
+                component.copy(out.data() + end, component.size());
+                if (end > begin)
+                {
+                    out[--end] = '/';
+                }
+            }
+            if (end > begin)
+            {
+                out[begin] = '/';
+            }
+        }
+
+        std::string path(Id id) const
+        {
+            std::string out;
+            this->append(id, out);
+            return out;
+        }
+
+        std::size_t size() const { return entries_.size() - free_.size(); }
+        std::size_t capacity() const { return entries_.size(); }
+
+        // Bytes held, for sizing: entries, names and the table
+        std::size_t memoryUsage() const
+        {
+            return entries_.capacity() * sizeof(Entry) + names_.capacity() + slots_.capacity() * sizeof(Slot) + free_.capacity() * sizeof(Id);
+        }
+
+        void clear()
+        {
+            entries_.assign(2, Entry());
+            entries_[ROOT].references = entries_[RELATIVE].references = 1;
+            names_.clear();
+            slots_.assign(64, Slot());
+            free_.clear();
+            used_ = 0;
+            garbage_ = 0;
+        }
+    };
+}
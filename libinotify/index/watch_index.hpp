@@ -0,0 +1,232 @@
+#pragma once
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "path_arena.hpp"
+
+namespace inotify
+{
+    // Maps watch descriptors to the path they were registered for and back.
+    // The kernel hands out small consecutive wds, so the forward direction is a dense table
+    // indexed by wd. Paths are interned in a PathArena, a slot holds a 32-bit id and the reverse
+    // direction is a dense table indexed by that id; full paths are only spelled out when asked for.
+    // A released wd keeps its last path until the kernel hands the wd out again, so events still
+    // queued for the consumer when the watch went away keep resolving.
+    // The arena is borrowed and may be shared with other indexes, whoever shares it guards it with
+    // the same lock as the indexes
+    class WatchIndex
+    {
+    private:
+        PathArena &arena_;
+        std::vector<PathArena::Id> paths_;                            // Slot wd holds the path watched by wd, NONE if never used
+        std::vector<bool> live_;                                      // Whether wd is currently registered
+        std::vector<int> descriptors_;                                // Arena id -> wd of the live watch on that path, -1 if none
+        std::size_t size_ = 0;
+
+        bool isLive(int wd) const
+        {
+            return wd >= 0 && static_cast<std::size_t>(wd) < live_.size() && live_[wd];
+        }
+
+        PathArena::Id id(int wd) const
+        {
+            return wd >= 0 && static_cast<std::size_t>(wd) < paths_.size() ? paths_[wd] : PathArena::NONE;
+        }
+
+    public:
+        explicit WatchIndex(PathArena &arena)
+            : arena_(arena)
+        {
+        }
+
+        ~WatchIndex()
+        {
+            clear();
+        }
+
+        WatchIndex(const WatchIndex &) = delete;
+        WatchIndex &operator=(const WatchIndex &) = delete;
+
+        // Records wd for path. inotify_add_watch() returns the existing wd when the same inode is
+        // added twice, in that case the slot is repointed to the new path
+        void insert(int wd, const std::filesystem::path &path)
+        {
+            if (wd < 0)
+            {
+                return;
+            }
+            if (static_cast<std::size_t>(wd) >= paths_.size())
+            {
+                paths_.resize(static_cast<std::size_t>(wd) + 1, PathArena::NONE);
+                live_.resize(static_cast<std::size_t>(wd) + 1, false);
+            }
+            erase(wd);
+            erase(path);
+
+            PathArena::Id id = arena_.intern(path.native());
+            if (paths_[wd] != PathArena::NONE)
+            {
+                arena_.release(paths_[wd]);
+            }
+            paths_[wd] = id;
+            live_[wd] = true;
+            if (id >= descriptors_.size())
+            {
+                descriptors_.resize(arena_.capacity(), -1);
+            }
+            descriptors_[id] = wd;
+            ++size_;
+        }
+
+        // Assigns the path watched by wd, or last watched by it if the watch was released, to path.
+        // False and path cleared if wd is unknown
+        bool find(int wd, std::string &path) const
+        {
+            path.clear();
+            return append(wd, path);
+        }
+
+        // Whether wd has a path, live or released
+        bool known(int wd) const
+        {
+            return this->id(wd) != PathArena::NONE;
+        }
+
+        // Like find() but appends to path
+        bool append(int wd, std::string &path) const
+        {
+            PathArena::Id id = this->id(wd);
+            if (id == PathArena::NONE)
+            {
+                return false;
+            }
+            arena_.append(id, path);
+            return true;
+        }
+
+        // Path of wd as find() has it, empty if wd is unknown
+        std::filesystem::path path(int wd) const
+        {
+            std::string path;
+            find(wd, path);
+            return path;
+        }
+
+        // Watch descriptor for path, -1 if the path is not watched
+        int find(const std::filesystem::path &path) const
+        {
+            PathArena::Id id = arena_.find(path.native());
+            return id < descriptors_.size() ? descriptors_[id] : -1;
+        }
+
+        bool contains(const std::filesystem::path &path) const
+        {
+            return find(path) >= 0;
+        }
+
+        // Drops the path -> wd direction only. Used for IN_DELETE_SELF and IN_MOVE_SELF, after which
+        // the old path no longer names the watched object but events may still arrive for wd
+        void unlink(int wd)
+        {
+            PathArena::Id id = this->id(wd);
+            if (id != PathArena::NONE && descriptors_[id] == wd)
+            {
+                descriptors_[id] = -1;
+            }
+        }
+
+        // Releases wd, used for IN_IGNORED once the kernel has dropped the watch
+        void erase(int wd)
+        {
+            if (!isLive(wd))
+            {
+                return;
+            }
+            unlink(wd);
+            live_[wd] = false;
+            --size_;
+        }
+
+        void erase(const std::filesystem::path &path)
+        {
+            int wd = find(path);
+            if (wd >= 0)
+            {
+                erase(wd);
+            }
+        }
+
+        // Repoints from and every watch below it to the same place under to, after a directory rename.
+        // The watches stay registered, only the arena entry of from moves. Returns the wd of from, -1 if unwatched
+        int rename(const std::filesystem::path &from, const std::filesystem::path &to)
+        {
+            PathArena::Id source = arena_.find(from.native());
+            if (source == PathArena::NONE)
+            {
+                return -1;
+            }
+            int moved = find(from);
+            PathArena::Id parent = arena_.intern(to.parent_path().native());
+            arena_.rename(source, parent, to.filename().native());
+            arena_.release(parent);
+            return moved;
+        }
+
+        // Watch descriptors of path and everything below it
+        std::vector<int> subtree(const std::filesystem::path &path) const
+        {
+            std::vector<int> result;
+            PathArena::Id top = arena_.find(path.native());
+            if (top == PathArena::NONE)
+            {
+                return result;
+            }
+            for (std::size_t wd = 0; wd < paths_.size(); ++wd)
+            {
+                if (live_[wd] && arena_.within(paths_[wd], top))
+                {
+                    result.push_back(static_cast<int>(wd));
+                }
+            }
+            return result;
+        }
+
+        // Calls func(int wd, const std::string &path) for every live watch
+        template <typename Callable>
+        void forEach(Callable &&func) const
+        {
+            std::string path;
+            for (std::size_t wd = 0; wd < paths_.size(); ++wd)
+            {
+                if (live_[wd])
+                {
+                    path.clear();
+                    arena_.append(paths_[wd], path);
+                    func(static_cast<int>(wd), path);
+                }
+            }
+        }
+
+        std::size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        const PathArena &arena() const { return arena_; }
+
+        // Drops every watch and the references it held on the arena
+        void clear()
+        {
+            for (PathArena::Id id : paths_)
+            {
+                if (id != PathArena::NONE)
+                {
+                    arena_.release(id);
+                }
+            }
+            descriptors_.clear();
+            paths_.clear();
+            live_.clear();
+            size_ = 0;
+        }
+    };
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace inotify
+{
+    // Minimal io_uring on the raw system calls, there is no liburing dependency. One ring is owned
+    // by one thread: requests are prepared with prepare(), handed to the kernel with submit() and
+    // their results collected with complete()
+    class Uring
+    {
+    private:
+        int fd_ = -1;
+        unsigned pending_ = 0; // Prepared but not yet submitted
+        unsigned tail_ = 0;    // Submission queue tail, published to the kernel by submit()
+
+        void *ring_ = MAP_FAILED;
+        std::size_t ring_size_ = 0;
+        void *completion_ring_ = MAP_FAILED; // Same mapping as ring_ with IORING_FEAT_SINGLE_MMAP
+        std::size_t completion_ring_size_ = 0;
+        struct io_uring_sqe *sqes_ = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+        std::size_t sqes_size_ = 0;
+
+        unsigned *sq_head_;
+        unsigned *sq_tail_;
+        unsigned sq_mask_;
+        unsigned sq_entries_;
+        unsigned *sq_array_;
+        unsigned *cq_head_;
+        unsigned *cq_tail_;
+        unsigned cq_mask_;
+        struct io_uring_cqe *cqes_;
+
+        static int setup(unsigned entries, struct io_uring_params &params)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        }
+
+        template <typename T>
+        static T *at(void *base, uint32_t offset)
+        {
+            return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+        }
+
+        void release()
+        {
+            if (sqes_ != MAP_FAILED)
+            {
+                munmap(sqes_, sqes_size_);
+            }
+            if (completion_ring_ != MAP_FAILED && completion_ring_ != ring_)
+            {
+                munmap(completion_ring_, completion_ring_size_);
+            }
+            if (ring_ != MAP_FAILED)
+            {
+                munmap(ring_, ring_size_);
+            }
+            if (fd_ >= 0)
+            {
+                close(fd_);
+            }
+        }
+
+    public:
+        static constexpr uint64_t BATCH_TAG = uint64_t(1) << 63; // user_data of requests issued by batch()
+
+        // Whether this kernel and process can use io_uring with every operation needed here. Checked
+        // once, io_uring may be missing (before Linux 5.11 for IORING_FEAT_EXT_ARG) or disabled by
+        // the kernel.io_uring_disabled sysctl or a seccomp policy
+        static bool supported()
+        {
+            static const bool result = []()
+            {
+                struct io_uring_params params = {};
+                int fd = setup(2, params);
+                if (fd < 0)
+                {
+                    return false;
+                }
+                constexpr unsigned OPS = 256;
+                std::vector<char> storage(sizeof(struct io_uring_probe) + OPS * sizeof(struct io_uring_probe_op));
+                auto *probe = reinterpret_cast<struct io_uring_probe *>(storage.data());
+                bool usable = (params.features & IORING_FEAT_EXT_ARG) &&
+                              syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, OPS) == 0;
+                for (int op : {IORING_OP_READ, IORING_OP_POLL_ADD, IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_CLOSE, IORING_OP_ASYNC_CANCEL})
+                {
+                    usable = usable && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+                }
+                close(fd);
+                return usable;
+            }();
+            return result;
+        }
+
+        explicit Uring(unsigned entries)
+        {
+            struct io_uring_params params = {};
+            fd_ = setup(entries, params);
+            if (fd_ < 0)
+            {
+                throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+            }
+
+            ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            completion_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                ring_size_ = completion_ring_size_ = std::max(ring_size_, completion_ring_size_);
+            }
+            ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+            completion_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring_ :
+                mmap(nullptr, completion_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+            sqes_ = static_cast<struct io_uring_sqe *>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+            if (ring_ == MAP_FAILED || completion_ring_ == MAP_FAILED || sqes_ == MAP_FAILED)
+            {
+                int error = errno;
+                this->release();
+                throw std::runtime_error(std::string("Failed to map io_uring: ") + std::strerror(error));
+            }
+
+            sq_head_ = at<unsigned>(ring_, params.sq_off.head);
+            sq_tail_ = at<unsigned>(ring_, params.sq_off.tail);
+            sq_mask_ = *at<unsigned>(ring_, params.sq_off.ring_mask);
+            sq_entries_ = *at<unsigned>(ring_, params.sq_off.ring_entries);
+            sq_array_ = at<unsigned>(ring_, params.sq_off.array);
+            tail_ = *sq_tail_;
+            cq_head_ = at<unsigned>(completion_ring_, params.cq_off.head);
+            cq_tail_ = at<unsigned>(completion_ring_, params.cq_off.tail);
+            cq_mask_ = *at<unsigned>(completion_ring_, params.cq_off.ring_mask);
+            cqes_ = at<struct io_uring_cqe>(completion_ring_, params.cq_off.cqes);
+        }
+
+        ~Uring()
+        {
+            this->release();
+        }
+
+        Uring(const Uring &) = delete;
+        Uring &operator=(const Uring &) = delete;
+
+        // Next free submission entry, zeroed, nullptr when the submission queue is full. It may be
+        // filled in until the next submit()
+        struct io_uring_sqe *prepare(uint8_t opcode, int fd, uint64_t user_data)
+        {
+            unsigned tail = tail_;
+            if (tail - std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire) >= sq_entries_)
+            {
+                return nullptr;
+            }
+            struct io_uring_sqe *sqe = &sqes_[tail & sq_mask_];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->user_data = user_data;
+            sq_array_[tail & sq_mask_] = tail & sq_mask_;
+            tail_ = tail + 1;
+            ++pending_;
+            return sqe;
+        }
+
+        // Submits the prepared requests and waits until wait completions are available or timeout
+        // nanoseconds passed (-1 for no limit). Returns the number submitted or -errno
+        int submit(unsigned wait = 0, int64_t timeout = -1)
+        {
+            struct __kernel_timespec time = {timeout / 1000000000, timeout % 1000000000};
+            struct io_uring_getevents_arg arg = {};
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = timeout >= 0 ? reinterpret_cast<uint64_t>(&time) : 0;
+            unsigned flags = (wait > 0 ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG;
+            std::atomic_ref<unsigned>(*sq_tail_).store(tail_, std::memory_order_release);
+            long result = syscall(__NR_io_uring_enter, fd_, pending_, wait, flags, &arg, sizeof(arg));
+            if (result < 0)
+            {
+                // A timeout or signal only ends the wait, the requests may still have been submitted
+                return errno == ETIME || errno == EINTR ? 0 : -errno;
+            }
+            pending_ -= static_cast<unsigned>(result);
+            return static_cast<int>(result);
+        }
+
+        // Calls func(uint64_t user_data, int result) for every completion available, returns their number
+        template <typename Callable>
+        unsigned complete(Callable &&func)
+        {
+            unsigned head = *cq_head_;
+            unsigned tail = std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+            unsigned count = tail - head;
+            for (; head != tail; ++head)
+            {
+                const struct io_uring_cqe &cqe = cqes_[head & cq_mask_];
+                uint64_t user_data = cqe.user_data;
+                int result = cqe.res;
+                std::atomic_ref<unsigned>(*cq_head_).store(head + 1, std::memory_order_release);
+                func(user_data, result);
+            }
+            return count;
+        }
+
+        // Issues count requests, fill(struct io_uring_sqe *, std::size_t index) fills in request
+        // index, and waits for all of them with a single submission per filled queue. results[index]
+        // receives each result. Completions of other requests arriving meanwhile go to other(user_data, result)
+        template <typename Fill, typename Other>
+        bool batch(std::size_t count, std::vector<int> &results, Fill &&fill, Other &&other)
+        {
+            results.assign(count, -ECANCELED);
+            std::size_t prepared = 0;
+            std::size_t completed = 0;
+            while (completed < count)
+            {
+                for (; prepared < count; ++prepared)
+                {
+                    struct io_uring_sqe *sqe = this->prepare(IORING_OP_NOP, -1, BATCH_TAG | prepared);
+                    if (sqe == nullptr)
+                    {
+                        break;
+                    }
+                    fill(sqe, prepared);
+                }
+                if (this->submit(1) < 0)
+                {
+                    return false;
+                }
+                this->complete([&](uint64_t user_data, int result)
+                {
+                    if (user_data & BATCH_TAG)
+                    {
+                        results[user_data & ~BATCH_TAG] = result;
+                        ++completed;
+                    }
+                    else
+                    {
+                        other(user_data, result);
+                    }
+                });
+            }
+            return true;
+        }
+    };
+}
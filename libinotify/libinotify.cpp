@@ -3,266 +3,2176 @@
 namespace inotify
 {
     // private
-    void Watcher::observeFiles()
+    void Watcher::observeFiles(Shard &shard)
     {
-        for (const auto &file : watch_list_)
+        // Watches are registered once by addWatch(), here the thread only sleeps until
+        // the kernel reports the backend descriptor readable or wakeUp() is called
+        if (use_io_uring_ && Uring::supported())
         {
-            int wd = inotify_add_watch(fd_, file.c_str(), IN_ALL_EVENTS);
+            try
+            {
+                shard.uring = std::make_unique<Uring>(URING_ENTRIES);
+            }
+            catch (const std::runtime_error &ex)
+            {
+                spdlog::warn("Shard {} falls back to epoll: {}", shard.id, ex.what());
+            }
+        }
+
+        while (run_watcher_thread_)
+        {
+            this->applyCoalescing(shard);
+
+            // Do not sleep while new directories are still waiting to be scanned, wake up for the
+            // next timer wheel tick while coalesced events are pending
+            int timeout = -1;
+            if (!shard.pending_scans.empty())
+            {
+                timeout = 0;
+            }
+            else
+            {
+                int64_t now = monotonicNanoseconds();
+                timeout = shard.renames.timeout(now);
+                if (shard.coalescer)
+                {
+                    int wheel = shard.coalescer->timeout(now);
+                    timeout = timeout < 0 || (wheel >= 0 && wheel < timeout) ? wheel : timeout;
+                }
+                if (shard.hot_changed)
+                {
+                    int64_t left = std::max<int64_t>(shard.hot_published + HOT_PATHS_INTERVAL - now, 0);
+                    int snapshot = static_cast<int>((left + 999999) / 1000000);
+                    timeout = timeout < 0 || snapshot < timeout ? snapshot : timeout;
+                }
+            }
+            if (!(shard.uring ? this->waitUring(shard, timeout) : this->waitEpoll(shard, timeout)))
+            {
+                break;
+            }
+
+            if (!shard.pending_scans.empty())
+            {
+                this->scanNewDirectories(shard);
+            }
+            if (shard.coalescer)
+            {
+                shard.coalescer->advance(monotonicNanoseconds(), shard.emit);
+            }
+            if (!shard.renames.empty())
+            {
+                this->expireRenames(shard, false);
+            }
+            if (shard.hot_changed)
+            {
+                int64_t now = monotonicNanoseconds();
+                if (now - shard.hot_published >= HOT_PATHS_INTERVAL)
+                {
+                    this->snapshotHotPaths(shard, now);
+                }
+            }
+
+            // One resumption per wakeup of the reader thread, not per event
+            if (await_slot_.waiting() && !shard.events.empty())
+            {
+                await_slot_.wake(resumer_);
+            }
+        }
+
+        // Hand over what is still held back before the thread stops
+        if (shard.coalescer)
+        {
+            shard.coalescer->flush(shard.emit);
+        }
+        this->expireRenames(shard, true);
+        if (shard.hot_changed)
+        {
+            this->snapshotHotPaths(shard, monotonicNanoseconds());
+        }
+        if (shard.uring)
+        {
+            this->stopUring(shard);
+        }
+    }
+
+    bool Watcher::waitEpoll(Shard &shard, int timeout)
+    {
+        std::array<struct epoll_event, MAX_EPOLL_EVENTS> ready;
+        int count = epoll_wait(shard.epoll_fd, ready.data(), ready.size(), timeout);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                return true;
+            }
+            spdlog::error("epoll_wait failed: {}", std::strerror(errno));
+            return false;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (ready[i].data.fd == shard.backend->descriptor())
+            {
+                shard.backend->read(shard, read_buffer_size_.load(std::memory_order_relaxed));
+            }
+            else if (ready[i].data.fd == shard.wakeup_fd)
+            {
+                this->drainWakeup(shard);
+            }
+        }
+        return true;
+    }
+
+    bool Watcher::waitUring(Shard &shard, int timeout)
+    {
+        // A poll on the backend descriptor stays queued, linked to a read into the backend's buffer
+        // when it has one, so the events arrive with the completion. A second poll waits for wakeUp()
+        Uring &uring = *shard.uring;
+        if (!shard.read_armed && shard.read_result == 0)
+        {
+            std::size_t capacity = 0;
+            char *buffer = shard.backend->readBuffer(read_buffer_size_.load(std::memory_order_relaxed), capacity);
+            struct io_uring_sqe *poll = uring.prepare(IORING_OP_POLL_ADD, shard.backend->descriptor(), URING_POLL);
+            poll->poll32_events = POLLIN;
+            if (buffer != nullptr)
+            {
+                poll->flags |= IOSQE_IO_LINK;
+                struct io_uring_sqe *read = uring.prepare(IORING_OP_READ, shard.backend->descriptor(), URING_READ);
+                read->addr = reinterpret_cast<uint64_t>(buffer);
+                read->len = static_cast<uint32_t>(capacity);
+                read->off = static_cast<uint64_t>(-1); // Current position, the descriptor is not seekable
+            }
+            shard.read_armed = true;
+            shard.read_linked = buffer != nullptr;
+        }
+        if (!shard.wakeup_armed)
+        {
+            uring.prepare(IORING_OP_POLL_ADD, shard.wakeup_fd, URING_WAKEUP)->poll32_events = POLLIN;
+            shard.wakeup_armed = true;
+        }
+
+        // Completions collected during a batched scan are handled first
+        bool handled = shard.read_result != 0 || shard.woken;
+        int submitted = uring.submit(handled ? 0 : 1, handled ? 0 : timeout < 0 ? -1 : int64_t(timeout) * 1000000);
+        if (submitted < 0)
+        {
+            spdlog::error("io_uring_enter failed: {}", std::strerror(-submitted));
+            return false;
+        }
+        uring.complete([&](uint64_t user_data, int result)
+        {
+            this->uringCompletion(shard, user_data, result);
+        });
+
+        if (shard.read_result > 0 && shard.read_linked)
+        {
+            shard.backend->parse(shard, static_cast<std::size_t>(shard.read_result));
+        }
+        else if (shard.read_result > 0)
+        {
+            shard.backend->read(shard, read_buffer_size_.load(std::memory_order_relaxed));
+        }
+        else if (shard.read_result < 0 && shard.read_result != -EAGAIN && shard.read_result != -ECANCELED)
+        {
+            spdlog::error("Failed to read events: {}", std::strerror(-shard.read_result));
+        }
+        shard.read_result = 0;
+        if (shard.woken)
+        {
+            this->drainWakeup(shard);
+            shard.woken = false;
+        }
+        return true;
+    }
+
+    void Watcher::uringCompletion(Shard &shard, uint64_t user_data, int result)
+    {
+        switch (user_data)
+        {
+            case URING_POLL:
+                // With a linked read only a failed poll ends the pair, the read then completes as cancelled
+                if (!shard.read_linked)
+                {
+                    shard.read_armed = false;
+                    shard.read_result = result > 0 ? 1 : result;
+                }
+                break;
+            case URING_READ:
+                shard.read_armed = false;
+                shard.read_result = result;
+                break;
+            case URING_WAKEUP:
+                shard.wakeup_armed = false;
+                shard.woken = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    void Watcher::stopUring(Shard &shard)
+    {
+        // The kernel may still write into the read buffer until the requests are gone
+        Uring &uring = *shard.uring;
+        for (uint64_t user_data : {URING_POLL, URING_READ, URING_WAKEUP})
+        {
+            if (struct io_uring_sqe *cancel = uring.prepare(IORING_OP_ASYNC_CANCEL, -1, URING_CANCEL))
+            {
+                cancel->addr = user_data;
+            }
+        }
+        while (shard.read_armed || shard.wakeup_armed)
+        {
+            if (uring.submit(1, 100000000) < 0)
+            {
+                break;
+            }
+            uring.complete([&](uint64_t user_data, int result)
+            {
+                this->uringCompletion(shard, user_data, result);
+            });
+        }
+        shard.uring.reset();
+        shard.read_result = 0;
+        shard.woken = false;
+    }
+
+    void Watcher::drainWakeup(Shard &shard)
+    {
+        uint64_t value;
+        if (read(shard.wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        {
+            spdlog::error("Failed to read wakeup descriptor: {}", std::strerror(errno));
+        }
+    }
+
+    void Watcher::applyCoalescing(Shard &shard)
+    {
+        shard.renames.setWindow(rename_window_.load(std::memory_order_relaxed));
+
+        // Picks up a window set by setCoalescing(), the coalescer is only touched by this thread
+        int64_t window = coalescing_window_.load(std::memory_order_relaxed);
+        if (window == (shard.coalescer ? shard.coalescer->window() : 0))
+        {
+            return;
+        }
+        if (shard.coalescer)
+        {
+            shard.coalescer->flush(shard.emit);
+        }
+        shard.coalescer.reset(window > 0 ? new EventCoalescer(window) : nullptr);
+    }
+
+    void Watcher::handleEvent(Shard &shard, const EventView &event, int64_t timestamp)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            this->recoverOverflow(shard, timestamp);
+            return;
+        }
+        if (event.mask & IN_IGNORED)
+        {
+            // The kernel dropped the watch (rm_watch, deletion or unmount), its wd may be reused
+            {
+                std::unique_lock lock(shard.index_mutex);
+                this->retireStatistics(shard, event.wd);
+                shard.index.erase(event.wd);
+            }
+            if (overflow_recovery_ != OverflowRecovery::OFF)
+            {
+                std::lock_guard lock(shard.snapshot_mutex);
+                shard.snapshots.erase(event.wd);
+                shard.active_directories.erase(event.wd);
+            }
+            return;
+        }
+
+        std::shared_lock lock(shard.index_mutex);
+        bool resolved = shard.index.known(event.wd);
+        bool directory = event.mask & IN_ISDIR;
+        if (resolved && !event.name.empty())
+        {
+            std::shared_lock filterLock(filter_mutex_);
+            if (directory || !filter_.empty())
+            {
+                // The watched directory itself passed the filter when it was added, only the entry is tested.
+                // A backend covering whole subtrees never had its directories filtered
+                shard.index.find(event.wd, shard.event_path);
+                shard.event_path.append(1, '/').append(event.name);
+                if (shard.backend->coversSubtree() ? filter_.excludedAnywhere(shard.event_path, directory) : filter_.excluded(shard.event_path, directory))
+                {
+                    return;
+                }
+            }
+        }
+        if (verbose_)
+        {
+            // Show information if verbose is true
+            std::string path = resolved ? shard.index.path(event.wd).native() : "?";
+            spdlog::debug("Event 0x{:08x} on {}{}{}", event.mask, path, event.name.empty() ? "" : "/", event.name);
+        }
+        lock.unlock();
+
+        if (resolved && overflow_recovery_ != OverflowRecovery::OFF)
+        {
+            // Directories with recent activity are always rescanned after an overflow. What was
+            // reported here goes into the snapshot, so the rescan does not report it again
+            shard.active_directories.insert(event.wd);
+            constexpr uint32_t SNAPSHOT_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE;
+            if (!event.name.empty() && (event.mask & SNAPSHOT_EVENTS))
+            {
+                this->updateSnapshot(shard, event.wd, event.name);
+            }
+        }
+
+        // A created directory passes the coalescer, the auto-watch below has to see it right away
+        if (shard.coalescer && shard.coalescer->add(event.wd, event.mask, event.cookie, event.name, timestamp, shard.emit))
+        {
+            return;
+        }
+
+        if (event.mask & IN_MOVED_FROM)
+        {
+            // Held back until the matching MOVED_TO shows up or the rename window passes. Both halves
+            // only meet if the two parent directories are watched by the same shard, otherwise the
+            // rename is reported as a move out and a move in
+            shard.renames.from(event.wd, event.mask, event.cookie, event.name, timestamp);
+            return;
+        }
+        if (event.mask & IN_MOVED_TO)
+        {
+            if (auto from = shard.renames.take(event.cookie))
+            {
+                this->publishRename(shard, *from, event);
+                return;
+            }
+        }
+
+        this->publish(shard, timestamp, event.wd, event.mask, event.cookie, event.name);
+
+        if (recursive_mode_ && resolved && directory && (event.mask & (IN_CREATE | IN_MOVED_TO)) && !shard.backend->coversSubtree())
+        {
+            // A directory created or moved in from outside the tree. Watch it right away, its current
+            // content is reported by scanNewDirectories()
+            int wd = this->addWatch(shard, shard.event_path);
+            if (wd >= 0)
+            {
+                shard.pending_scans.emplace_back(shard.event_path, wd);
+            }
+        }
+
+        if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+        {
+            // The old path no longer names the watched object, stop resolving it to this wd.
+            // After a rename inside the tree the index already holds the new path
+            std::unique_lock writeLock(shard.index_mutex);
+            if (!shard.moved_watches.erase(event.wd))
+            {
+                shard.index.unlink(event.wd);
+            }
+        }
+    }
+
+    void Watcher::recoverOverflow(Shard &shard, int64_t timestamp)
+    {
+        // Events were lost. Every watched directory with a snapshot is compared against its current
+        // state in parallel and the differences are reported as CREATE/DELETE/MODIFY. With
+        // OverflowRecovery::ACTIVE a directory is only listed if it had events since its snapshot
+        // or its own modification time changed, which skips most of a large, mostly idle tree.
+        // Only the queue of this shard overflowed, the other shards are not rescanned. The diff is
+        // built under snapshot_mutex, the events are published and new directories watched after
+        // releasing it, so slow handlers do not hold up anyone waiting for the snapshots
+        spdlog::warn("Kernel event queue of shard {} overflowed, events were lost", shard.id);
+        this->publish(shard, timestamp, -1, IN_Q_OVERFLOW, 0, {}, EventKind::OVERFLOW);
+
+        OverflowRecovery mode = overflow_recovery_;
+        if (mode == OverflowRecovery::OFF)
+        {
+            return;
+        }
+
+        struct Job
+        {
+            int wd;
+            std::string path;
+            DirectorySnapshot *before;
+            bool active;
+            bool changed = false;
+            DirectorySnapshot after;
+            std::vector<std::pair<std::string, uint32_t>> events;
+        };
+
+        std::unique_lock lock(shard.snapshot_mutex);
+        std::vector<Job> jobs;
+        jobs.reserve(shard.snapshots.size());
+        {
+            std::shared_lock indexLock(shard.index_mutex);
+            std::string path;
+            for (auto &[wd, snapshot] : shard.snapshots)
+            {
+                if (shard.index.find(wd, path))
+                {
+                    jobs.push_back(Job{wd, path, &snapshot, shard.active_directories.contains(wd), false, {}, {}});
+                }
+            }
+        }
+
+        forEachParallel(jobs.size(), walker_.getThreads(), [&](std::size_t i, std::vector<char> &buffer)
+        {
+            Job &job = jobs[i];
+            if (mode == OverflowRecovery::ACTIVE && !job.active && DirectorySnapshot::directoryTime(job.path) == job.before->mtime)
+            {
+                return;
+            }
+            job.after = DirectorySnapshot::capture(job.path, buffer);
+            job.changed = true;
+            DirectorySnapshot::diff(*job.before, job.after, [&](std::string_view name, uint32_t mask)
+            {
+                job.events.emplace_back(name, mask);
+            });
+        });
+
+        // Snapshots may come and go while unlocked, job.before is not used past here
+        lock.unlock();
+
+        auto watched = [this](const std::string &path)
+        {
+            std::shared_lock indexLock(index_mutex_);
+            return std::any_of(shards_.begin(), shards_.end(), [&](const auto &other) { return other->index.contains(path); });
+        };
+
+        std::size_t count = 0;
+        std::vector<int> deleted;
+        for (Job &job : jobs)
+        {
+            for (const auto &[name, mask] : job.events)
+            {
+                this->publish(shard, timestamp, job.wd, mask, 0, name);
+                std::string child = job.path + '/' + name;
+                if (mask == (IN_CREATE | IN_ISDIR))
+                {
+                    // Already watched if its own events got through before the overflow
+                    if (recursive_mode_ && !watched(child))
+                    {
+                        int wd = this->addWatch(shard, child);
+                        if (wd >= 0)
+                        {
+                            shard.pending_scans.emplace_back(std::move(child), wd);
+                        }
+                    }
+                }
+                else if (mask == (IN_DELETE | IN_ISDIR))
+                {
+                    // Its IN_IGNORED may have been lost with the overflow
+                    std::vector<int> watches;
+                    {
+                        std::unique_lock indexLock(shard.index_mutex);
+                        watches = shard.index.subtree(child);
+                        for (int wd : watches)
+                        {
+                            this->retireStatistics(shard, wd);
+                        }
+                    }
+                    this->releaseSubtree(child, true);
+                    deleted.insert(deleted.end(), watches.begin(), watches.end());
+                }
+            }
+            count += job.events.size();
+        }
+
+        lock.lock();
+        for (Job &job : jobs)
+        {
+            auto snapshot = shard.snapshots.find(job.wd);
+            if (job.changed && snapshot != shard.snapshots.end())
+            {
+                snapshot->second = std::move(job.after);
+            }
+        }
+        for (int wd : deleted)
+        {
+            shard.snapshots.erase(wd);
+        }
+        lock.unlock();
+        shard.active_directories.clear();
+        spdlog::info("Overflow recovery reported {} changes", count);
+    }
+
+    void Watcher::updateSnapshot(Shard &shard, int wd, std::string_view name)
+    {
+        std::lock_guard lock(shard.snapshot_mutex);
+        auto snapshot = shard.snapshots.find(wd);
+        if (snapshot == shard.snapshots.end())
+        {
+            return;
+        }
+        {
+            std::shared_lock indexLock(shard.index_mutex);
+            if (!shard.index.find(wd, shard.snapshot_path))
+            {
+                return;
+            }
+        }
+        snapshot->second.update(shard.snapshot_path, name);
+    }
+
+    void Watcher::captureSnapshots(Shard &shard, const std::vector<std::pair<int, std::string>> &directories)
+    {
+        std::vector<DirectorySnapshot> captured(directories.size());
+        forEachParallel(directories.size(), walker_.getThreads(), [&](std::size_t i, std::vector<char> &buffer)
+        {
+            captured[i] = DirectorySnapshot::capture(directories[i].second, buffer);
+        });
+        std::lock_guard lock(shard.snapshot_mutex);
+        for (std::size_t i = 0; i < directories.size(); ++i)
+        {
+            shard.snapshots[directories[i].first] = std::move(captured[i]);
+        }
+    }
+
+    void Watcher::publishRename(Shard &shard, const RenameMatcher::Pending &from, const EventView &to)
+    {
+        // Watches below a renamed directory stay valid, only the paths recorded for them change.
+        // Nothing is re-walked or re-registered. With ShardPolicy::PATH_HASH the subtree may be
+        // spread over several shards, moving its entry in the shared arena renames it for all of them.
+        // A file watched with WatchMode::FILES keeps its watch the same way
+        std::filesystem::path source, target;
+        {
+            std::shared_lock lock(shard.index_mutex);
+            if (shard.index.known(from.wd) && shard.index.known(to.wd))
+            {
+                source = shard.index.path(from.wd) / from.name;
+                target = shard.index.path(to.wd) / to.name;
+            }
+        }
+        if (!source.empty() && ((from.mask & IN_ISDIR) || watch_mode_ == WatchMode::FILES))
+        {
+            std::unique_lock lock(index_mutex_);
+            for (auto &other : shards_)
+            {
+                int wd = other->index.find(source);
+                if (wd >= 0)
+                {
+                    other->moved_watches.insert(wd);
+                }
+            }
+            shard.index.rename(source, target);
+        }
+
+        // One record carries both names as "old/new", '/' cannot occur inside a name
+        shard.rename_name.assign(from.name).append(1, '/').append(to.name);
+        this->publish(shard, from.timestamp, to.wd, from.mask | to.mask, to.cookie, shard.rename_name, EventKind::RENAME, from.wd);
+    }
+
+    void Watcher::expireRenames(Shard &shard, bool all)
+    {
+        // A MOVED_FROM without partner moved the entry out of the watched tree. The kernel keeps
+        // watching a directory or file moved elsewhere, so its watches are released here
+        auto moved_out = [this, &shard](RenameMatcher::Pending &&from)
+        {
+            this->publish(shard, from.timestamp, from.wd, from.mask, from.cookie, from.name);
+            if ((from.mask & IN_ISDIR) || watch_mode_ == WatchMode::FILES)
+            {
+                std::filesystem::path directory;
+                {
+                    std::shared_lock lock(shard.index_mutex);
+                    if (shard.index.known(from.wd))
+                    {
+                        directory = shard.index.path(from.wd) / from.name;
+                    }
+                }
+                if (!directory.empty())
+                {
+                    this->releaseSubtree(directory, false);
+                }
+            }
+        };
+        if (all)
+        {
+            shard.renames.flush(moved_out);
+        }
+        else
+        {
+            shard.renames.expire(monotonicNanoseconds(), moved_out);
+        }
+    }
+
+    void Watcher::releaseSubtree(const std::filesystem::path &path, bool erase)
+    {
+        // Removes the watches on path and below from every shard. With erase, or a backend that does not
+        // confirm the removal, the index entries are dropped right away instead of when the IN_IGNORED is read
+        for (auto &shard : shards_)
+        {
+            std::vector<int> watches;
+            {
+                std::unique_lock lock(shard->index_mutex);
+                watches = shard->index.subtree(path);
+                if (erase || !shard->backend->reportsIgnored())
+                {
+                    for (int wd : watches)
+                    {
+                        shard->index.erase(wd);
+                    }
+                }
+            }
+            for (int wd : watches)
+            {
+                shard->backend->removeWatch(wd);
+            }
+        }
+    }
+
+    void Watcher::publish(Shard &shard, int64_t timestamp, int wd, uint32_t mask, uint32_t cookie, std::string_view name, EventKind kind, int from_wd)
+    {
+        if (!shard.events.push(timestamp, wd, mask, cookie, name, static_cast<uint8_t>(kind), from_wd))
+        {
+            if (shard.dropped_events.fetch_add(1, std::memory_order_relaxed) == 0)
+            {
+                spdlog::warn("Event queue of shard {} is full, events are being dropped", shard.id);
+            }
+        }
+        if (statistics_.load(std::memory_order_relaxed))
+        {
+            this->count(shard, wd, mask, kind, from_wd);
+        }
+        if (shard.hot_files)
+        {
+            this->track(shard, wd, name, kind, from_wd);
+        }
+        if (dispatcher_.wants(mask))
+        {
+            this->dispatch(shard, timestamp, wd, mask, cookie, name, kind, from_wd);
+        }
+    }
+
+    void Watcher::retireStatistics(Shard &shard, int wd)
+    {
+        // The wd is about to be released and may be handed out again. Like inotifywatch, the counts
+        // stay reported under the path it had, merged with earlier watches of the same path.
+        // Called by the reader thread with index_mutex held exclusively, before the wd is erased
+        auto key = static_cast<uint32_t>(wd);
+        if (!shard.statistics.counted(key))
+        {
+            return;
+        }
+        if (!shard.index.known(wd))
+        {
+            shard.statistics.reset(key);
+            return;
+        }
+        auto retired = static_cast<uint32_t>(EventStatistics::RETIRED + shard.retired_paths.size());
+        auto [entry, inserted] = shard.retired_keys.try_emplace(shard.index.path(wd).native(), retired);
+        if (inserted)
+        {
+            shard.retired_paths.emplace_back(entry->first);
+        }
+        shard.statistics.retire(key, entry->second);
+    }
+
+    void Watcher::count(Shard &shard, int wd, uint32_t mask, EventKind kind, int from_wd)
+    {
+        // The table is only written here, by the reader thread, readers copy it without a lock. A
+        // reset asked for by resetStatistics() is carried out first. A rename counts against both directories
+        uint32_t resets = shard.statistics_resets.load(std::memory_order_acquire);
+        if (resets != shard.statistics_applied.load(std::memory_order_relaxed))
+        {
+            shard.statistics.clear();
+            shard.statistics_applied.store(resets, std::memory_order_release);
+        }
+        uint32_t selected = statistics_mask_.load(std::memory_order_relaxed);
+        if (kind == EventKind::RENAME)
+        {
+            shard.statistics.add(static_cast<uint32_t>(from_wd), IN_MOVED_FROM & selected);
+            shard.statistics.add(static_cast<uint32_t>(wd), IN_MOVED_TO & selected);
+        }
+        else if (kind == EventKind::EVENT)
+        {
+            shard.statistics.add(static_cast<uint32_t>(wd), mask & selected);
+        }
+    }
+
+    void Watcher::track(Shard &shard, int wd, std::string_view name, EventKind kind, int from_wd)
+    {
+        // Files are keyed by (wd, name), no path is built per event. A rename counts for the new
+        // name and for both directories
+        if (kind == EventKind::OVERFLOW)
+        {
+            return;
+        }
+        if (kind == EventKind::RENAME)
+        {
+            std::size_t separator = name.find('/');
+            name.remove_prefix(separator == std::string_view::npos ? name.size() : separator + 1);
+        }
+        uint64_t directory = uint64_t(static_cast<uint32_t>(wd)) + 1;
+        shard.hot_files->add(std::hash<std::string_view>{}(name) ^ (directory * 0x9e3779b97f4a7c15ull), [&]()
+        {
+            return HotPathLabel{wd, std::string(name)};
+        });
+        shard.hot_directories->add(directory, [wd]() { return wd; });
+        if (kind == EventKind::RENAME && from_wd >= 0 && from_wd != wd)
+        {
+            shard.hot_directories->add(uint64_t(static_cast<uint32_t>(from_wd)) + 1, [from_wd]() { return from_wd; });
+        }
+        shard.hot_changed = true;
+    }
+
+    void Watcher::snapshotHotPaths(Shard &shard, int64_t now)
+    {
+        // The reader thread copies its sketches at most every HOT_PATHS_INTERVAL, readers of the
+        // snapshot never hold it back for longer than a pointer swap
+        auto snapshot = std::make_shared<HotPathSnapshot>();
+        snapshot->files = shard.hot_files->counters();
+        snapshot->directories = shard.hot_directories->counters();
+        snapshot->file_error = shard.hot_files->errorBound();
+        snapshot->directory_error = shard.hot_directories->errorBound();
+        {
+            std::lock_guard lock(shard.hot_mutex);
+            shard.hot_snapshot = std::move(snapshot);
+        }
+        shard.hot_changed = false;
+        shard.hot_published = now;
+    }
+
+    void Watcher::dispatch(Shard &shard, int64_t timestamp, int wd, uint32_t mask, uint32_t cookie, std::string_view name, EventKind kind, int from_wd)
+    {
+        {
+            std::shared_lock lock(shard.index_mutex);
+            this->resolvePath(shard, wd, name, kind, from_wd, shard.dispatch_path, shard.dispatch_from);
+        }
+
+        if (handler_pool_)
+        {
+            // Keyed lanes keep the events of one path (or directory) in order across the workers
+            std::string_view key = shard.dispatch_path;
+            if (handler_ordering_ == HandlerOrdering::DIRECTORY)
+            {
+                std::size_t slash = key.rfind('/');
+                key = key.substr(0, slash == std::string_view::npos ? 0 : slash);
+            }
+            uint64_t hash = std::hash<std::string_view>{}(key);
+            handler_pool_->submit(hash, HandlerTask{kind, shard.dispatch_path, shard.dispatch_from, mask, cookie, timestamp});
+            return;
+        }
+
+        EventRef event;
+        event.kind = kind;
+        event.path = shard.dispatch_path;
+        event.from = shard.dispatch_from;
+        event.mask = mask;
+        event.cookie = cookie;
+        event.timestamp = timestamp;
+        dispatcher_.dispatch(event, shard.dispatch_candidates);
+    }
+
+    void Watcher::scanNewDirectories(Shard &shard)
+    {
+        // Entries created between mkdir and inotify_add_watch() produced no event, report them as
+        // CREATE. Only a bounded number of directories is scanned per loop iteration so that a
+        // mkdir -p or tar x storm does not hold back delivery of the events queued meanwhile.
+        // An entry created after the watch landed may be reported twice, never missed
+        int64_t timestamp = monotonicNanoseconds();
+        std::size_t count = std::min<std::size_t>(auto_watch_budget_, shard.pending_scans.size());
+        std::vector<std::pair<std::string, int>> directories;
+        directories.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            directories.push_back(std::move(shard.pending_scans.front()));
+            shard.pending_scans.pop_front();
+        }
+
+        auto found = [&](const std::string &directory, int parent, std::string_view name, unsigned char type)
+        {
+            std::string child = directory;
+            child.append(1, '/').append(name);
+            {
+                std::shared_lock lock(filter_mutex_);
+                if (filter_.excluded(child, type == DT_DIR))
+                {
+                    return;
+                }
+            }
+
+            this->publish(shard, timestamp, parent, type == DT_DIR ? IN_CREATE | IN_ISDIR : IN_CREATE, 0, name);
+            if (type == DT_DIR)
+            {
+                int wd = this->addWatch(shard, child);
+                if (wd >= 0)
+                {
+                    shard.pending_scans.emplace_back(std::move(child), wd);
+                }
+            }
+            else if (type == DT_REG && watch_mode_ == WatchMode::FILES)
+            {
+                this->addWatch(shard, child);
+            }
+        };
+
+        if (!shard.uring || !this->scanBatched(shard, directories, found))
+        {
+            for (const auto &[directory, parent] : directories)
+            {
+                DirectoryWalker::readDirectory(directory, shard.scan_buffer, [&](std::string_view name, unsigned char type)
+                {
+                    found(directory, parent, name, type);
+                });
+            }
+        }
+
+        if (overflow_recovery_ != OverflowRecovery::OFF)
+        {
+            std::vector<std::pair<int, std::string>> scanned;
+            scanned.reserve(directories.size());
+            for (auto &[directory, parent] : directories)
+            {
+                scanned.emplace_back(parent, std::move(directory));
+            }
+            this->captureSnapshots(shard, scanned);
+        }
+    }
+
+    bool Watcher::scanBatched(Shard &shard, const std::vector<std::pair<std::string, int>> &directories,
+                              const std::function<void(const std::string &, int, std::string_view, unsigned char)> &found)
+    {
+        // The whole batch costs one io_uring_enter() per step instead of one system call per
+        // directory and entry: open all directories, list them, stat the entries the file system
+        // reports no type for, close them. Completions for the reader's own requests are kept
+        Uring &uring = *shard.uring;
+        auto other = [&](uint64_t user_data, int result)
+        {
+            this->uringCompletion(shard, user_data, result);
+        };
+
+        std::vector<int> descriptors;
+        if (!uring.batch(directories.size(), descriptors, [&](struct io_uring_sqe *sqe, std::size_t i)
+        {
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uint64_t>(directories[i].first.c_str());
+            sqe->open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        }, other))
+        {
+            spdlog::warn("Batched directory scan failed, scanning one by one");
+            for (int descriptor : descriptors)
+            {
+                if (descriptor >= 0)
+                {
+                    close(descriptor);
+                }
+            }
+            return false;
+        }
+
+        struct Entry
+        {
+            std::size_t directory;
+            std::string name;
+            unsigned char type;
+        };
+        std::vector<Entry> entries;
+        std::vector<std::size_t> unknown;
+        for (std::size_t i = 0; i < directories.size(); ++i)
+        {
+            if (descriptors[i] < 0)
+            {
+                // Removed again before the scan, its DELETE_SELF is on the way
+                continue;
+            }
+            DirectoryWalker::readDirectory(descriptors[i], directories[i].first, shard.scan_buffer, [&](std::string_view name, unsigned char type)
+            {
+                if (type == DT_UNKNOWN)
+                {
+                    unknown.push_back(entries.size());
+                }
+                entries.push_back({i, std::string(name), type});
+            }, false);
+        }
+
+        if (!unknown.empty())
+        {
+            std::vector<struct statx> stats(unknown.size());
+            std::vector<int> results;
+            uring.batch(unknown.size(), results, [&](struct io_uring_sqe *sqe, std::size_t i)
+            {
+                const Entry &entry = entries[unknown[i]];
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = descriptors[entry.directory];
+                sqe->addr = reinterpret_cast<uint64_t>(entry.name.c_str());
+                sqe->len = STATX_TYPE;
+                sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+                sqe->addr2 = reinterpret_cast<uint64_t>(&stats[i]);
+            }, other);
+            for (std::size_t i = 0; i < unknown.size(); ++i)
+            {
+                if (results[i] == 0)
+                {
+                    entries[unknown[i]].type = IFTODT(stats[i].stx_mode);
+                }
+            }
+        }
+
+        std::vector<int> closed;
+        uring.batch(directories.size(), closed, [&](struct io_uring_sqe *sqe, std::size_t i)
+        {
+            // A NOP stands in for directories that failed to open
+            if (descriptors[i] >= 0)
+            {
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = descriptors[i];
+            }
+        }, other);
+
+        for (const Entry &entry : entries)
+        {
+            found(directories[entry.directory].first, directories[entry.directory].second, entry.name, entry.type);
+        }
+        return true;
+    }
+
+    int Watcher::addWatch(Shard &shard, const std::filesystem::path &path)
+    {
+        int wd = shard.backend->addWatch(path);
+        if (wd < 0)
+        {
+            spdlog::error("Failed to add watch for file: {}", path);
+            return wd;
+        }
+        {
+            std::unique_lock lock(shard.index_mutex);
+            shard.index.insert(wd, path);
+        }
+        if (verbose_)
+        {
+            // Show information if verbose is true
+            spdlog::info("Watching file: {}", path);
+        }
+        return wd;
+    }
+
+    int Watcher::addWatch(const std::filesystem::path &path)
+    {
+        return this->addWatch(this->shardFor(path.native()), path);
+    }
+
+    void Watcher::removeWatch(const std::filesystem::path &path)
+    {
+        for (auto &shard : shards_)
+        {
+            int wd;
+            {
+                std::shared_lock lock(shard->index_mutex);
+                wd = shard->index.find(path);
+            }
             if (wd < 0)
             {
-                spdlog::error("Failed to add watch for file: {}", file);
                 continue;
             }
-            if (verbose_)
+            if (shard->backend->removeWatch(wd) < 0)
+            {
+                spdlog::error("Failed to remove watch for file: {}", path);
+            }
+            else if (!shard->backend->reportsIgnored())
+            {
+                // Otherwise the index entry is dropped when the resulting IN_IGNORED is read
+                std::unique_lock lock(shard->index_mutex);
+                shard->index.erase(wd);
+            }
+        }
+    }
+
+    void Watcher::wakeUp()
+    {
+        uint64_t value = 1;
+        for (auto &shard : shards_)
+        {
+            if (write(shard->wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            {
+                spdlog::error("Failed to wake observer thread: {}", std::strerror(errno));
+            }
+        }
+    }
+
+    std::unique_ptr<Watcher::Shard> Watcher::createShard(std::size_t id)
+    {
+        // The descriptors are closed by ~Shard() if one of the steps below throws
+        auto shard = std::make_unique<Shard>(*this, id);
+        if (hot_capacity_ > 0)
+        {
+            shard->hot_files = std::make_unique<SpaceSaving<HotPathLabel>>(hot_capacity_);
+            shard->hot_directories = std::make_unique<SpaceSaving<int>>(hot_capacity_);
+        }
+        shard->emit = [this, shard = shard.get()](int wd, uint32_t mask, uint32_t cookie, std::string_view name, int64_t timestamp)
+        {
+            this->publish(*shard, timestamp, wd, mask, cookie, name);
+        };
+
+        if (backend_type_ == BackendType::FANOTIFY)
+        {
+            shard->backend = std::make_unique<FanotifyBackend>(fanotify_mark_);
+        }
+        else if (backend_type_ == BackendType::POLLING)
+        {
+            shard->backend = std::make_unique<PollingBackend>(walker_.getThreads(), poll_min_interval_, poll_max_interval_);
+        }
+        else
+        {
+            shard->backend = std::make_unique<InotifyBackend>();
+        }
+
+        shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        shard->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->epoll_fd < 0 || shard->wakeup_fd < 0)
+        {
+            spdlog::error("Failed to create epoll instance: {}", std::strerror(errno));
+            throw std::runtime_error("Failed to create epoll instance.");
+        }
+
+        for (int descriptor : {shard->backend->descriptor(), shard->wakeup_fd})
+        {
+            struct epoll_event interest = {};
+            interest.events = EPOLLIN;
+            interest.data.fd = descriptor;
+            if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, descriptor, &interest) < 0)
+            {
+                spdlog::error("Failed to register descriptor with epoll: {}", std::strerror(errno));
+                throw std::runtime_error("Failed to register descriptor with epoll.");
+            }
+        }
+        return shard;
+    }
+
+    std::string_view Watcher::shardKey(std::string_view root, std::string_view path) const
+    {
+        // With ShardPolicy::SUBTREE a path is placed by its first component below root, so a
+        // subtree and the renames inside it stay within one shard
+        if (shard_policy_ == ShardPolicy::PATH_HASH || path.size() <= root.size() + 1)
+        {
+            return path;
+        }
+        return path.substr(0, path.find('/', root.size() + 1));
+    }
+
+    Watcher::Shard &Watcher::shardFor(std::string_view key)
+    {
+        return *shards_[shards_.size() == 1 ? 0 : std::hash<std::string_view>{}(key) % shards_.size()];
+    }
+
+    void Watcher::pinShards()
+    {
+        // Reader thread i runs on the i-th CPU the process may use, wrapping around when there are
+        // more shards than CPUs
+        cpu_set_t allowed;
+        if (shards_.size() < 2 || sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        {
+            return;
+        }
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        for (auto &shard : shards_)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[shard->id % cpus.size()], &set);
+            int error = pthread_setaffinity_np(shard->thread.native_handle(), sizeof(set), &set);
+            if (error != 0)
+            {
+                spdlog::warn("Failed to pin shard {} to CPU {}: {}", shard->id, cpus[shard->id % cpus.size()], std::strerror(error));
+            }
+        }
+    }
+
+    // public
+    Watcher::Watcher()
+    {
+        try
+        {
+            #ifdef NDEBUG
+                spdlog::set_level(spdlog::level::info); // Set global log level to info for release version
+                spdlog::info("Log level set to info for release version");
+                verbose_ = false;
+            #else
+                spdlog::set_level(spdlog::level::debug); // Set global log level to debug for developer version
+                spdlog::info("Log level set to debug for developer version");
+                verbose_ = true;
+            #endif
+        }
+        catch (const spdlog::spdlog_ex &ex)
+        {
+            spdlog::warn("Failed to set log level: {}", ex.what());
+        }
+
+        shards_.push_back(this->createShard(0));
+
+        this->enable();
+    }
+
+    void Watcher::enable()
+    {
+        if (shards_.front()->thread.joinable())
+        {
+            return;
+        }
+        stopped_ = false;
+        run_watcher_thread_ = true;
+        for (auto &shard : shards_)
+        {
+            shard->thread = std::thread([this, &shard = *shard]()
+            {
+                this->observeFiles(shard);
+            });
+        }
+        if (pin_shards_)
+        {
+            this->pinShards();
+        }
+        spdlog::info("Watcher enabled");
+    }
+
+    void Watcher::disable()
+    {
+        this->stop(true);
+        spdlog::info("Watcher disabled");
+    }
+
+    void Watcher::stop(bool final)
+    {
+        // Joins the reader threads. The internal restarts (setShards(), setIoUring(), ...) pass
+        // final = false and leave a coroutine waiting in next() parked until the threads are back
+        run_watcher_thread_ = false;
+        this->wakeUp();
+        for (auto &shard : shards_)
+        {
+            if (!shard->thread.joinable())
+            {
+                continue;
+            }
+            if (std::this_thread::get_id() != shard->thread.get_id())
+            {
+                shard->thread.join();
+            }
+            else
+            {
+                shard->thread.detach();
+            }
+        }
+        if (final)
+        {
+            // A coroutine waiting in next() gets std::nullopt
+            stopped_ = true;
+            await_slot_.wake(resumer_);
+        }
+    }
+
+    void Watcher::setShards(unsigned count, ShardPolicy policy, bool pin)
+    {
+        // Spreads the watches over count inotify instances, each with its own kernel queue (bounded
+        // by max_queued_events) and reader thread. Must be called before any path is added
+        count = std::clamp(count, 1u, 256u);
+        {
+            bool watching = false;
+            for (auto &shard : shards_)
+            {
+                std::shared_lock lock(shard->index_mutex);
+                watching = watching || shard->index.size() != 0;
+            }
+            if (watching)
+            {
+                spdlog::error("setShards() must be called before any path is watched.");
+                throw std::logic_error("setShards() must be called before any path is watched.");
+            }
+        }
+
+        shard_policy_ = policy;
+        pin_shards_ = pin;
+        this->rebuildShards(count);
+    }
+
+    void Watcher::rebuildShards(std::size_t count)
+    {
+        bool running = !shards_.empty() && shards_.front()->thread.joinable();
+        this->stop(false);
+        shards_.clear();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            shards_.push_back(this->createShard(i));
+        }
+        if (running)
+        {
+            this->enable();
+        }
+    }
+
+    void Watcher::setBackend(BackendType type, FanotifyMark mark)
+    {
+        // Like setShards(), only before any path is watched. On failure (e.g. fanotify without
+        // CAP_SYS_ADMIN) the exception is passed on and the inotify backend is restored
+        for (auto &shard : shards_)
+        {
+            std::shared_lock lock(shard->index_mutex);
+            if (shard->index.size() != 0)
+            {
+                spdlog::error("setBackend() must be called before any path is watched.");
+                throw std::logic_error("setBackend() must be called before any path is watched.");
+            }
+        }
+
+        std::size_t count = shards_.size();
+        bool running = shards_.front()->thread.joinable();
+        backend_type_ = type;
+        fanotify_mark_ = mark;
+        try
+        {
+            this->rebuildShards(count);
+        }
+        catch (...)
+        {
+            backend_type_ = BackendType::INOTIFY;
+            this->rebuildShards(count);
+            if (running)
+            {
+                this->enable();
+            }
+            throw;
+        }
+        spdlog::info("Using the {} backend", shards_.front()->backend->name());
+    }
+
+    BackendType Watcher::getBackend() const
+    {
+        return backend_type_;
+    }
+
+    void Watcher::setPollInterval(std::chrono::milliseconds min, std::chrono::milliseconds max)
+    {
+        // A directory with changes is polled again after min, a quiet one backs off up to max
+        poll_min_interval_ = std::chrono::duration_cast<std::chrono::nanoseconds>(min).count();
+        poll_max_interval_ = std::chrono::duration_cast<std::chrono::nanoseconds>(max).count();
+        for (auto &shard : shards_)
+        {
+            if (auto *polling = dynamic_cast<PollingBackend *>(shard->backend.get()))
+            {
+                polling->setIntervals(poll_min_interval_, poll_max_interval_);
+            }
+        }
+    }
+
+    bool Watcher::off(EventDispatcher::HandlerId id)
+    {
+        // Handlers may still be running on a reader thread, removal waits for them to return. Called
+        // from a handler, the removal is carried out once the event has been dispatched
+        return dispatcher_.remove(id);
+    }
+
+    void Watcher::setHandlerThreads(unsigned threads, HandlerOrdering ordering, std::size_t lanes)
+    {
+        // With threads > 0 the reader threads only copy the event into a lane and go back to the
+        // kernel queue, so a slow handler no longer makes it overflow. 0 runs the handlers on the
+        // reader threads again. The queued handlers finish before the old pool goes away
+        bool running = shards_.front()->thread.joinable();
+        if (running)
+        {
+            this->stop(false);
+        }
+        handler_pool_.reset();
+        handler_ordering_ = ordering;
+        if (threads > 0)
+        {
+            handler_pool_ = std::make_unique<WorkerPool<HandlerTask>>(threads, lanes != 0 ? lanes : threads * 16, [this](HandlerTask &task)
+            {
+                // One scratch bitmap per worker thread
+                thread_local std::vector<uint64_t> candidates;
+                EventRef event;
+                event.kind = task.kind;
+                event.path = task.path;
+                event.from = task.from;
+                event.mask = task.mask;
+                event.cookie = task.cookie;
+                event.timestamp = task.timestamp;
+                dispatcher_.dispatch(event, candidates);
+            });
+        }
+        if (running)
+        {
+            this->enable();
+        }
+    }
+
+    WorkerPoolStats Watcher::getHandlerStats() const
+    {
+        return handler_pool_ ? handler_pool_->stats() : WorkerPoolStats();
+    }
+
+    bool Watcher::setIoUring(bool enabled)
+    {
+        // The reader threads pick it up when they start, running ones are restarted. Without
+        // io_uring support (old kernel, disabled by sysctl or seccomp) epoll stays in use
+        bool running = shards_.front()->thread.joinable();
+        if (running)
+        {
+            this->stop(false);
+        }
+        use_io_uring_ = enabled;
+        if (running)
+        {
+            this->enable();
+        }
+        if (enabled && !Uring::supported())
+        {
+            spdlog::warn("io_uring is not available, the reader threads use epoll");
+        }
+        return enabled && Uring::supported();
+    }
+
+    std::size_t Watcher::getShardCount() const
+    {
+        return shards_.size();
+    }
+
+    void Watcher::setOrderedOutput(bool ordered)
+    {
+        // With several shards, true merges getCurrentEvents() by time, false returns them shard by shard
+        ordered_output_ = ordered;
+    }
+    
+    void Watcher::excludeFile(const std::string &file)
+    {
+        // Check if the watcher is in recursive mode
+        if (!this->recursive_mode_)
+        {
+            spdlog::error("excludeFile requires the watcher to be in recursive mode.");
+            throw std::runtime_error("excludeFile requires the watcher to be in recursive mode.");
+        }
+
+        // Exclude the file from the watch list if it's already there
+        if (this->unlistWatch(file))
+        {
+            this->removeWatch(file);
+        }
+
+        // The file is also reported through the watch on its parent, drop those events too
+        {
+            std::unique_lock lock(filter_mutex_);
+            filter_.excludePath(std::filesystem::path(file).lexically_normal().native());
+        }
+    }
+
+    void Watcher::fromFile(const std::string &file)
+    {
+        std::ifstream infile(file);
+        std::string line;
+        while (std::getline(infile, line))
+        {
+            if (line[0] == '@')
+            {
+                if (this->listWatch(line.substr(1), DT_UNKNOWN))
+                {
+                    this->addWatch(line.substr(1));
+                    if (verbose_)
+                    { 
+                        // Show information if verbose is true
+                        spdlog::info("Added to watchlist: {}", line.substr(1));
+                    }
+                }
+            }
+            else if (line[0] == '-')
+            {
+                if (this->unlistWatch(line.substr(1)))
+                {
+                    this->removeWatch(line.substr(1));
+                    if (verbose_)
+                    { 
+                        // Show information if verbose is true
+                        spdlog::info("Removed from watchlist: {}", line.substr(1));
+                    }
+                }
+            }
+        }
+    }
+
+    void Watcher::resolvePath(const Shard &shard, int wd, std::string_view name, EventKind kind, int from_wd, std::string &path, std::string &from) const
+    {
+        // Like getCurrentEvents() into reused buffers, the caller holds index_mutex
+        from.clear();
+        if (kind == EventKind::RENAME)
+        {
+            std::size_t separator = name.find('/');
+            if (shard.index.append(from_wd, from))
+            {
+                from.append(1, '/');
+            }
+            from.append(name.substr(0, separator));
+            name.remove_prefix(separator + 1);
+        }
+        bool directory = shard.index.find(wd, path);
+        if (directory && !name.empty())
+        {
+            path.append(1, '/');
+        }
+        path.append(name);
+    }
+
+    std::size_t Watcher::watch(NdjsonWriter &writer, std::size_t limit)
+    {
+        // Drains the queued events into writer as NDJSON, shard by shard like consumeEvents(), without
+        // building a FileEvent or JSON value per event. Flushes writer if it has a descriptor
+        std::size_t count = 0;
+        std::string path, from;
+        for (auto &shard : shards_)
+        {
+            std::shared_lock lock(shard->index_mutex);
+            count += shard->events.consume([&](const EventRecord &record, std::string_view name)
+            {
+                auto kind = static_cast<EventKind>(record.kind);
+                this->resolvePath(*shard, record.wd, name, kind, record.from_wd, path, from);
+                writer.add(kind, path, from, record.mask, record.cookie, record.timestamp);
+            }, limit - count);
+        }
+        if (writer.descriptor() >= 0 && !writer.flush())
+        {
+            spdlog::error("Failed to write events: {}", std::strerror(errno));
+        }
+        return count;
+    }
+
+    std::size_t Watcher::exportEvents(EventEncoder &encoder, std::size_t limit)
+    {
+        // Adds the queued events to the encoder's batch, the caller encodes and ships it. The
+        // directory of an event is the path of its watch, so the dictionary needs no path splitting
+        std::size_t count = 0;
+        std::string directory, from_directory;
+        for (auto &shard : shards_)
+        {
+            std::shared_lock lock(shard->index_mutex);
+            count += shard->events.consume([&](const EventRecord &record, std::string_view name)
+            {
+                auto kind = static_cast<EventKind>(record.kind);
+                std::string_view from_name;
+                from_directory.clear();
+                if (kind == EventKind::RENAME)
+                {
+                    std::size_t separator = name.find('/');
+                    shard->index.find(record.from_wd, from_directory);
+                    from_name = name.substr(0, separator);
+                    name.remove_prefix(separator + 1);
+                }
+                shard->index.find(record.wd, directory);
+                encoder.add(kind, directory, name, from_directory, from_name, record.mask, record.cookie, record.timestamp);
+            }, limit - count);
+        }
+        return count;
+    }
+
+    EventBatchPool::Handle Watcher::drainBatch(std::size_t limit)
+    {
+        // Drains the queued events shard by shard into a recycled batch. Each directory is spelled
+        // once per batch, straight from the watch index into the batch's string pool
+        EventBatchPool::Handle batch = batch_pool_->acquire();
+        std::size_t count = 0;
+        for (auto &shard : shards_)
+        {
+            std::shared_lock lock(shard->index_mutex);
+            auto directory = [&](int wd)
+            {
+                if (!shard->index.known(wd))
+                {
+                    return EventBatch::NO_DIRECTORY;
+                }
+                return batch->directory((uint64_t(shard->id) << 32) | static_cast<uint32_t>(wd), [&](std::string &pool)
+                {
+                    shard->index.append(wd, pool);
+                });
+            };
+            count += shard->events.consume([&](const EventRecord &record, std::string_view name)
+            {
+                auto kind = static_cast<EventKind>(record.kind);
+                batch->add(record.timestamp, directory(record.wd), record.mask, record.cookie, name, kind,
+                           kind == EventKind::RENAME ? directory(record.from_wd) : EventBatch::NO_DIRECTORY, record.shard);
+            }, limit - count);
+        }
+        return batch;
+    }
+
+    std::vector<FileEvent> Watcher::getCurrentEvents()
+    {
+        // Single consumer: drains everything the reader threads have queued so far
+        std::vector<FileEvent> result;
+        std::string path, from;
+        for (auto &shard : shards_)
+        {
+            result.reserve(result.size() + shard->events.size());
+            std::shared_lock lock(shard->index_mutex);
+            shard->events.consume([&](const EventRecord &record, std::string_view name)
+            {
+                FileEvent &event = result.emplace_back();
+                event.kind = static_cast<EventKind>(record.kind);
+                this->resolvePath(*shard, record.wd, name, event.kind, record.from_wd, path, from);
+                event.path = path;
+                event.from = from;
+                event.mask = record.mask;
+                event.cookie = record.cookie;
+                event.time = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(record.timestamp));
+            });
+        }
+        if (ordered_output_ && shards_.size() > 1)
+        {
+            // Stable, so events of one shard with equal timestamps keep their order
+            std::stable_sort(result.begin(), result.end(), [](const FileEvent &a, const FileEvent &b)
+            {
+                return a.time < b.time;
+            });
+        }
+        return result;
+    }
+
+    bool Watcher::hasEvents() const
+    {
+        for (const auto &shard : shards_)
+        {
+            if (!shard->events.empty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Watcher::takeEvents(std::size_t limit, std::vector<FileEvent> &events)
+    {
+        // Whatever the awaiters drained earlier comes first
+        if (awaited_.empty())
+        {
+            for (FileEvent &event : this->getCurrentEvents())
             {
-                // Show information if verbose is true
-                spdlog::info("Watching file: {}", file);
+                awaited_.push_back(std::move(event));
             }
         }
+        while (!awaited_.empty() && events.size() < limit)
+        {
+            events.push_back(std::move(awaited_.front()));
+            awaited_.pop_front();
+        }
+    }
+
+    std::optional<FileEvent> Watcher::NextAwaiter::await_resume()
+    {
+        std::vector<FileEvent> events;
+        watcher_.takeEvents(1, events);
+        if (events.empty())
+        {
+            return std::nullopt;
+        }
+        return std::move(events.front());
+    }
+
+    std::vector<FileEvent> Watcher::BatchAwaiter::await_resume()
+    {
+        std::vector<FileEvent> events;
+        watcher_.takeEvents(limit_, events);
+        return events;
+    }
+
+    void Watcher::setResumer(AwaitSlot::Resumer resumer)
+    {
+        // The reader threads resume the awaiting coroutine through it, e.g. by posting it to an
+        // executor. Without one the coroutine runs on a reader thread until its next co_await
+        bool running = shards_.front()->thread.joinable();
+        if (running)
+        {
+            this->stop(false);
+        }
+        resumer_ = std::move(resumer);
+        if (running)
+        {
+            this->enable();
+        }
     }
 
-    // public
-    Watcher::Watcher()
+    uint64_t Watcher::getDroppedEvents() const
     {
-        this->enable();
+        uint64_t dropped = 0;
+        for (const auto &shard : shards_)
+        {
+            dropped += shard->dropped_events.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
 
-        fd_ = NULL;
-        try
+    //syf
+
+    void Watcher::zero()
+    {
+        // Outputs table rows and columns even if all elements are zero
+        zero_ = true;
+        this->setStatistics(true);
+    }
+
+    void Watcher::exclude(const std::string &pattern)
+    {
+        // Implementation of not processing any events whose filename matches the specified POSIX extended regular expression, case sensitive
         {
-            #ifdef NDEBUG
-                spdlog::set_level(spdlog::level::info); // Set global log level to info for release version
-                spdlog::info("Log level set to info for release version");
-                verbose_ = false;
-            #else
-                spdlog::set_level(spdlog::level::debug); // Set global log level to debug for developer version
-                spdlog::info("Log level set to debug for developer version");
-                verbose_ = true;
-            #endif
+            std::unique_lock lock(filter_mutex_);
+            filter_.excludeRegex(pattern);
         }
-        catch (const spdlog::spdlog_ex &ex)
+        this->pruneWatchList();
+    }
+
+    void Watcher::excludei(const std::string &pattern)
+    {
+        // Implementation of not processing any events whose filename matches the specified POSIX extended regular expression, case insensitive
         {
-            spdlog::warn("Failed to set log level: {}", ex.what());
+            std::unique_lock lock(filter_mutex_);
+            filter_.excludeRegex(pattern, true);
         }
+        this->pruneWatchList();
+    }
 
-        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
-        if (fd_ < 0)
+    void Watcher::excludeGlob(const std::string &pattern, bool icase)
+    {
+        // Not processing any events for paths matching the glob, e.g. "*.swp" or "**/node_modules/**"
         {
-            switch(errno)
-            {
-                case EINVAL:
-                    spdlog::error("Invalid value specified in flags for inotify_init1.");
-                    throw std::invalid_argument("Invalid value specified in flags for inotify_init1.");
-                case EMFILE:
-                    spdlog::error("User limit on total number of inotify instances has been reached.");
-                    throw std::runtime_error("User limit on total number of inotify instances has been reached.");
-                case ENFILE:
-                    spdlog::error("System-wide limit on total number of open files has been reached.");
-                    throw std::runtime_error("System-wide limit on total number of open files has been reached.");
-                case ENOMEM:
-                    spdlog::error("Insufficient kernel memory is available.");
-                    throw std::runtime_error("Insufficient kernel memory is available.");
-                default:
-                    spdlog::error("Failed to initialize inotify.");
-                    throw std::runtime_error("Failed to initialize inotify.");
-            }
+            std::unique_lock lock(filter_mutex_);
+            filter_.excludeGlob(pattern, icase);
         }
+        this->pruneWatchList();
+    }
 
-        run_watcher_thread_ = true;
-        if (std::this_thread::get_id() != observer_thread_.get_id() && observer_thread_.joinable())
+    void Watcher::includeGlob(const std::string &pattern)
+    {
+        // Once set, only events for files matching one of the include globs are processed
         {
-            observer_thread_.join();
+            std::unique_lock lock(filter_mutex_);
+            filter_.includeGlob(pattern);
         }
+        this->pruneWatchList();
+    }
 
-        observer_thread_ = std::thread([this]()
+    bool Watcher::listWatch(std::string_view path, unsigned char type)
+    {
+        // Adds path to the watch list, false if it is there already
+        std::unique_lock lock(index_mutex_);
+        PathArena::Id id = paths_.intern(path);
+        if (!watch_list_.emplace(id, type).second)
         {
-            while (run_watcher_thread_) {
-                this->observeFiles();
-            } 
-        });
+            paths_.release(id);
+            return false;
+        }
+        return true;
     }
-    
-    void Watcher::excludeFile(const std::string &file)
+
+    bool Watcher::unlistWatch(std::string_view path)
     {
-        // Check if the watcher is in recursive mode
-        if (!this->recursive_mode_)
+        // Removes path from the watch list, false if it was not there
+        std::unique_lock lock(index_mutex_);
+        auto it = watch_list_.find(paths_.find(path));
+        if (it == watch_list_.end())
         {
-            spdlog::error("excludeFile requires the watcher to be in recursive mode.");
-            throw std::runtime_error("excludeFile requires the watcher to be in recursive mode.");
+            return false;
         }
+        paths_.release(it->first);
+        watch_list_.erase(it);
+        return true;
+    }
 
-        // Exclude the file from the watch list if it's already there
-        auto it = watch_list_.begin();
-        while (it != watch_list_.end())
+    void Watcher::pruneWatchList()
+    {
+        // Drops watches the filter now excludes, paths added later are filtered while traversing
+        std::vector<std::pair<std::string, unsigned char>> listed;
         {
-            if (*it == file)
+            std::shared_lock lock(index_mutex_);
+            listed.reserve(watch_list_.size());
+            for (const auto &[id, type] : watch_list_)
             {
-                it = watch_list_.erase(it);
+                listed.emplace_back(paths_.path(id), type);
             }
-            else
+        }
+        for (const auto &[path, type] : listed)
+        {
+            // The walker reported the type, only paths read by fromFile() have to be looked up
+            bool directory = type == DT_UNKNOWN ? std::filesystem::is_directory(path) : type == DT_DIR;
+            bool excluded;
+            {
+                std::shared_lock lock(filter_mutex_);
+                excluded = filter_.excludedAnywhere(path, directory);
+            }
+            if (excluded && this->unlistWatch(path))
             {
-                ++it;
+                if (verbose_)
+                { // Show information if verbose is true
+                    spdlog::info("Removed from watchlist: {}", path);
+                }
+                this->removeWatch(path);
             }
         }
     }
 
-    void Watcher::fromFile(const std::string &file)
+    void Watcher::recursive(const std::string &path)
     {
-        std::ifstream infile(file);
-        std::string line;
-        while (std::getline(infile, line))
+        // Implementation of watching all subdirectories of any directories passed as arguments.
+        // The tree is listed by the parallel DirectoryWalker, watches are then registered from this thread.
+        // In WatchMode::DIRECTORIES only directories get a watch, events on their entries are attributed
+        // through the name reported with the event
+        std::filesystem::path root(path);
+        if (std::filesystem::is_directory(root) && shards_.front()->backend->coversSubtree())
         {
-            if (line[0] == '@')
+            // One mark covers the whole tree, nothing is walked. Excluded paths are dropped per event
+            this->recursive_mode_ = true;
+            root = std::filesystem::canonical(root);
+            this->listWatch(root.native(), DT_DIR);
+            if (this->addWatch(root) >= 0 && verbose_)
+            { // Show information if verbose is true
+                spdlog::info("Added to watchlist: {}", root.string());
+            }
+            if (overflow_recovery_ != OverflowRecovery::OFF)
             {
-                auto it = std::find(watch_list_.begin(), watch_list_.end(), line.substr(1));
-                if (it == watch_list_.end())
-                {
-                    watch_list_.push_back(line.substr(1));
-                    if (verbose_)
-                    { 
-                        // Show information if verbose is true
-                        spdlog::info("Added to watchlist: {}", line.substr(1));
-                    }
-                }
+                spdlog::warn("Overflow recovery is not available with the {} backend", shards_.front()->backend->name());
             }
-            else if (line[0] == '-')
+        }
+        else if (std::filesystem::is_directory(root))
+        {
+            // Set the recursive mode flag
+            this->recursive_mode_ = true;
+            std::vector<std::vector<std::pair<int, std::string>>> directories(shards_.size()); // Snapshotted for overflow recovery, per shard
+            walker_.setIncludeFiles(watch_mode_ == WatchMode::FILES);
+            walker_.setFilter([this](std::string_view entry, unsigned char type)
+            {
+                // Excluded directories are pruned with their whole subtree
+                std::shared_lock lock(filter_mutex_);
+                return filter_.empty() || !filter_.excluded(entry, type == DT_DIR);
+            });
+            for (const WalkEntry &entry : walker_.walk(root))
             {
-                auto it = std::find(watch_list_.begin(), watch_list_.end(), line.substr(1));
-                if (it != watch_list_.end())
+                // Directories are always watched, like scanNewDirectories() does for new ones, so
+                // entries created later are seen in both modes
+                if (entry.type == DT_DIR || (entry.type == DT_REG && watch_mode_ == WatchMode::FILES))
                 {
-                    watch_list_.erase(it);
+                    this->listWatch(entry.path, entry.type);
+                    Shard &shard = this->shardFor(this->shardKey(root.native(), entry.path));
+                    int wd = this->addWatch(shard, entry.path);
                     if (verbose_)
-                    { 
-                        // Show information if verbose is true
-                        spdlog::info("Removed from watchlist: {}", line.substr(1));
+                    { // Show information if verbose is true
+                        spdlog::info("Added to watchlist: {}", entry.path);
+                    }
+                    if (wd >= 0 && entry.type == DT_DIR && overflow_recovery_ != OverflowRecovery::OFF)
+                    {
+                        directories[shard.id].emplace_back(wd, entry.path);
                     }
                 }
             }
+            for (auto &shard : shards_)
+            {
+                this->captureSnapshots(*shard, directories[shard->id]);
+            }
+        }
+        else if (std::filesystem::is_regular_file(root))
+        {
+            // A file passed explicitly always gets its own watch
+            spdlog::warn("The provided path is a file, not a directory: {}", root.string());
+            this->listWatch(root.native(), DT_REG);
+            this->addWatch(root);
+            if (verbose_)
+            { // Show information if verbose is true
+                spdlog::info("Added to watchlist: {}", root.string());
+            }
         }
     }
 
-    nlohmann::json Watcher::watch() const
+    void Watcher::timeout(int seconds)
     {
-        nlohmann::json emptyJson;
-        emptyJson["date"] = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-        return emptyJson;
+        // Implementation of listening only for the specified amount of seconds
+        spdlog::info("Timer set for {} seconds", seconds);
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        spdlog::info("Timer of {} seconds has elapsed", seconds);
+        // Stop the observer thread after the timer ends, disable() wakes it and joins
+        this->disable();
     }
 
-    //syf
+    void Watcher::event(const std::string &event)
+    {
+        // Counts only the listed event(s), e.g. "modify,close_write". Repeated calls add to the list
+        uint32_t mask = 0;
+        std::size_t start = 0;
+        while (start <= event.size())
+        {
+            std::size_t end = event.find_first_of(",| ", start);
+            std::string_view name = std::string_view(event).substr(start, end == std::string::npos ? std::string::npos : end - start);
+            start = end == std::string::npos ? event.size() + 1 : end + 1;
+            if (name.empty())
+            {
+                continue;
+            }
+            int column = EventStatistics::column(name);
+            std::string lower(name);
+            std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (column > 0)
+            {
+                mask |= EventStatistics::COLUMN_MASKS[column];
+            }
+            else if (lower == "close")
+            {
+                mask |= IN_CLOSE;
+            }
+            else if (lower == "move")
+            {
+                mask |= IN_MOVE;
+            }
+            else if (lower == "all")
+            {
+                mask |= EventStatistics::COUNTED;
+            }
+            else
+            {
+                spdlog::error("Unknown event: {}", name);
+                throw std::invalid_argument(fmt::format("Unknown event: {}", name));
+            }
+        }
+        statistics_mask_ = statistics_events_ ? statistics_mask_ | mask : mask;
+        statistics_events_ = true;
+        this->setStatistics(true);
+    }
 
-    void Watcher::zero()
+    void Watcher::ascending(const std::string &event)
+    {
+        // Sorts the table ascending by event counts for the specified event ("total" for all)
+        int column = EventStatistics::column(event);
+        if (column < 0)
+        {
+            spdlog::error("Unknown event: {}", event);
+            throw std::invalid_argument("Unknown event: " + event);
+        }
+        sort_column_ = column;
+        sort_ascending_ = true;
+        this->setStatistics(true);
+    }
+
+    void Watcher::descending(const std::string &event)
     {
-        // Implementation of outputting table rows and columns even if all elements are zero
+        // Sorts the table descending by event counts for the specified event ("total" for all)
+        int column = EventStatistics::column(event);
+        if (column < 0)
+        {
+            spdlog::error("Unknown event: {}", event);
+            throw std::invalid_argument("Unknown event: " + event);
+        }
+        sort_column_ = column;
+        sort_ascending_ = false;
+        this->setStatistics(true);
     }
 
-    void Watcher::exclude(const std::string &pattern)
+    void Watcher::setStatistics(bool enabled)
     {
-        // Implementation of not processing any events whose filename matches the specified POSIX extended regular expression, case sensitive
-        std::regex pattern_regex(pattern);
-        for (auto it = watch_list_.begin(); it != watch_list_.end();)
+        // Counting happens on the reader threads, one table per shard keyed by wd
+        statistics_ = enabled;
+    }
+
+    void Watcher::resetStatistics()
+    {
+        // Carried out by each reader thread before it counts again, the tables read as empty meanwhile
+        for (auto &shard : shards_)
+        {
+            shard->statistics_resets.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    std::vector<StatisticsRow> Watcher::getStatistics(std::size_t limit)
+    {
+        // The per-shard counters are merged here, copied while the reader threads keep counting, and
+        // sorted afterwards. Only the first limit rows are fully ordered and get their paths looked up
+        struct Candidate
+        {
+            std::size_t shard;
+            uint32_t key;                  // wd, or from EventStatistics::RETIRED on a released watch
+            EventStatistics::Counters counts;
+        };
+        std::vector<Candidate> candidates;
+        std::unordered_set<uint32_t> counted;
+        for (auto &shard : shards_)
         {
-            if (std::regex_match(it->string(), pattern_regex))
+            std::size_t first = candidates.size();
+            if (shard->statistics_resets.load(std::memory_order_acquire) == shard->statistics_applied.load(std::memory_order_acquire))
             {
-                if (verbose_)
-                { // Show information if verbose is true
-                    spdlog::info("Removed from watchlist: {}", *it);
+                candidates.reserve(candidates.size() + shard->statistics.size());
+                shard->statistics.forEach([&](uint32_t key, const EventStatistics::Counters &counts)
+                {
+                    candidates.push_back(Candidate{shard->id, key, counts});
+                });
+            }
+            if (zero_)
+            {
+                counted.clear();
+                for (std::size_t i = first; i < candidates.size(); ++i)
+                {
+                    counted.insert(candidates[i].key);
                 }
-                it = watch_list_.erase(it);
+                std::shared_lock indexLock(shard->index_mutex);
+                shard->index.forEach([&](int wd, const std::string &)
+                {
+                    if (!counted.contains(static_cast<uint32_t>(wd)))
+                    {
+                        candidates.push_back(Candidate{shard->id, static_cast<uint32_t>(wd), {}});
+                    }
+                });
             }
-            else
+        }
+
+        int column = sort_column_;
+        bool ascending = sort_ascending_;
+        auto order = [column, ascending](const Candidate &a, const Candidate &b)
+        {
+            if (a.counts[column] != b.counts[column])
             {
-                ++it;
+                return ascending ? a.counts[column] < b.counts[column] : a.counts[column] > b.counts[column];
             }
+            return a.shard != b.shard ? a.shard < b.shard : a.key < b.key;
+        };
+        if (limit < candidates.size())
+        {
+            std::nth_element(candidates.begin(), candidates.begin() + limit, candidates.end(), order);
+            candidates.resize(limit);
         }
-    }
+        std::sort(candidates.begin(), candidates.end(), order);
 
-    void Watcher::excludei(const std::string &pattern)
-    {
-        // Implementation of not processing any events whose filename matches the specified POSIX extended regular expression, case insensitive
-        std::regex pattern_regex(pattern, std::regex::icase);
-        for (auto it = watch_list_.begin(); it != watch_list_.end();)
+        std::vector<StatisticsRow> rows(candidates.size());
+        for (std::size_t i = 0; i < candidates.size(); ++i)
         {
-            if (std::regex_match(it->string(), pattern_regex))
+            Shard &shard = *shards_[candidates[i].shard];
+            uint32_t key = candidates[i].key;
+            std::shared_lock lock(shard.index_mutex);
+            if (key >= EventStatistics::RETIRED)
             {
-                if (verbose_)
-                { // Show information if verbose is true
-                    spdlog::info("Removed from watchlist: {}", *it);
-                }
-                it = watch_list_.erase(it);
+                rows[i].path = shard.retired_paths[key - EventStatistics::RETIRED];
             }
             else
             {
-                ++it;
+                int wd = static_cast<int>(key);
+                rows[i].path = shard.index.known(wd) ? shard.index.path(wd) : std::filesystem::path(fmt::format("<wd {}>", wd));
             }
+            rows[i].counts = candidates[i].counts;
         }
+        return rows;
     }
 
-    void Watcher::recursive(const std::string &path)
+    void Watcher::setHotPaths(std::size_t capacity)
+    {
+        // Each shard keeps two Space-Saving sketches of capacity counters, files and directories.
+        // Counts start over, running reader threads are restarted
+        bool running = shards_.front()->thread.joinable();
+        if (running)
+        {
+            this->stop(false);
+        }
+        hot_capacity_ = capacity;
+        for (auto &shard : shards_)
+        {
+            shard->hot_files = capacity > 0 ? std::make_unique<SpaceSaving<HotPathLabel>>(capacity) : nullptr;
+            shard->hot_directories = capacity > 0 ? std::make_unique<SpaceSaving<int>>(capacity) : nullptr;
+            shard->hot_changed = false;
+            std::lock_guard lock(shard->hot_mutex);
+            shard->hot_snapshot.reset();
+        }
+        if (running)
+        {
+            this->enable();
+        }
+    }
+
+    std::vector<HotPath> Watcher::getHotPaths(std::size_t k, HotPathKind kind)
     {
-        // Implementation of watching all subdirectories of any directories passed as arguments
-        // Using C++20 and recursive function
-        std::function<void(const std::filesystem::path &)> traverse = [&](const std::filesystem::path &p)
+        // Reads the snapshots the reader threads publish, at most HOT_PATHS_INTERVAL old. A path is
+        // only ever counted by one shard, so the shards' counters are simply put together
+        struct Candidate
+        {
+            std::size_t shard;
+            int wd;
+            const std::string *name;
+            uint64_t count;
+            uint64_t error;
+        };
+        std::vector<std::shared_ptr<const HotPathSnapshot>> snapshots;
+        std::vector<Candidate> candidates;
+        uint64_t untracked = 0; // No path without a counter occurred more often than this
+        for (auto &shard : shards_)
         {
-            if (std::filesystem::is_directory(p))
+            std::shared_ptr<const HotPathSnapshot> snapshot;
+            {
+                std::lock_guard lock(shard->hot_mutex);
+                snapshot = shard->hot_snapshot;
+            }
+            if (!snapshot)
+            {
+                continue;
+            }
+            if (kind == HotPathKind::FILES)
             {
-                // Set the recursive mode flag
-                this->recursive_mode_ = true;
-                for (auto &entry : std::filesystem::directory_iterator(p))
+                for (const auto &counter : snapshot->files)
                 {
-                    if (std::filesystem::is_directory(entry))
-                    {
-                        traverse(entry.path());
-                    }
-                    else if (std::filesystem::is_regular_file(entry))
-                    {
-                        watch_list_.push_back(entry.path());
-                        if (verbose_)
-                        { // Show information if verbose is true
-                            spdlog::info("Added to watchlist: {}", entry.path().string());
-                        }
-                    }
+                    candidates.push_back(Candidate{shard->id, counter.label.wd, &counter.label.name, counter.count, counter.error});
                 }
+                untracked = std::max(untracked, snapshot->file_error);
             }
-            else if (std::filesystem::is_regular_file(p))
+            else
             {
-                spdlog::warn("The provided path is a file, not a directory: {}", p.string());
-                watch_list_.push_back(p);
-                if (verbose_)
-                { // Show information if verbose is true
-                    spdlog::info("Added to watchlist: {}", p.string());
+                for (const auto &counter : snapshot->directories)
+                {
+                    candidates.push_back(Candidate{shard->id, counter.label, nullptr, counter.count, counter.error});
                 }
+                untracked = std::max(untracked, snapshot->directory_error);
+            }
+            snapshots.push_back(std::move(snapshot));
+        }
+
+        auto order = [](const Candidate &a, const Candidate &b)
+        {
+            if (a.count != b.count)
+            {
+                return a.count > b.count;
             }
+            return a.shard != b.shard ? a.shard < b.shard : a.wd < b.wd;
         };
+        uint64_t threshold = untracked;
+        if (k < candidates.size())
+        {
+            std::nth_element(candidates.begin(), candidates.begin() + k, candidates.end(), order);
+            threshold = std::max(threshold, candidates[k].count);
+            candidates.resize(k);
+        }
+        std::sort(candidates.begin(), candidates.end(), order);
 
-        traverse(std::filesystem::path(path));
+        std::vector<HotPath> hot(candidates.size());
+        for (std::size_t i = 0; i < candidates.size(); ++i)
+        {
+            Shard &shard = *shards_[candidates[i].shard];
+            {
+                std::shared_lock lock(shard.index_mutex);
+                hot[i].path = shard.index.known(candidates[i].wd) ? shard.index.path(candidates[i].wd)
+                                                                  : std::filesystem::path(fmt::format("<wd {}>", candidates[i].wd));
+            }
+            if (candidates[i].name && !candidates[i].name->empty())
+            {
+                hot[i].path /= *candidates[i].name;
+            }
+            hot[i].count = candidates[i].count;
+            hot[i].error = candidates[i].error;
+            hot[i].guaranteed = candidates[i].count - candidates[i].error >= threshold;
+        }
+        return hot;
     }
 
-    void Watcher::timeout(int seconds)
+    std::string Watcher::formatStatistics(std::size_t limit)
     {
-        // Implementation of listening only for the specified amount of seconds
-        spdlog::info("Timer set for {} seconds", seconds);
-        std::this_thread::sleep_for(std::chrono::seconds(seconds));
-        spdlog::info("Timer of {} seconds has elapsed", seconds);
-        // Ensure the object is destroyed after the timer ends
-        if (observer_thread_.joinable())
+        // Same layout as inotifywatch: a total column, one column per event type seen (all counted
+        // types after zero()), the path last
+        std::vector<StatisticsRow> rows = this->getStatistics(limit);
+        uint32_t selected = statistics_mask_;
+        std::vector<std::size_t> columns = {0};
+        for (std::size_t column = 1; column < EventStatistics::COLUMNS; ++column)
+        {
+            bool used = zero_ && (EventStatistics::COLUMN_MASKS[column] & selected);
+            for (std::size_t i = 0; i < rows.size() && !used; ++i)
+            {
+                used = rows[i].counts[column] != 0;
+            }
+            if (used)
+            {
+                columns.push_back(column);
+            }
+        }
+
+        std::vector<std::size_t> widths;
+        for (std::size_t column : columns)
         {
-            observer_thread_.join();
+            std::size_t width = std::strlen(EventStatistics::COLUMN_NAMES[column]);
+            for (const StatisticsRow &row : rows)
+            {
+                width = std::max(width, fmt::formatted_size("{}", row.counts[column]));
+            }
+            widths.push_back(width + 2);
         }
-        this->disable();
+
+        std::string table;
+        for (std::size_t i = 0; i < columns.size(); ++i)
+        {
+            fmt::format_to(std::back_inserter(table), "{:<{}}", EventStatistics::COLUMN_NAMES[columns[i]], widths[i]);
+        }
+        table += "filename\n";
+        for (const StatisticsRow &row : rows)
+        {
+            for (std::size_t i = 0; i < columns.size(); ++i)
+            {
+                fmt::format_to(std::back_inserter(table), "{:<{}}", row.counts[columns[i]], widths[i]);
+            }
+            table += row.path.native();
+            table += '\n';
+        }
+        return table;
     }
 
-    void Watcher::event(const std::string &event)
+    void Watcher::setWatchMode(WatchMode mode)
     {
-        // Implementation of listening for specific event(s) only
+        // Only affects paths added afterwards, existing watches are kept as they are
+        this->watch_mode_ = mode;
     }
 
-    void Watcher::ascending(const std::string &event)
+    WatchMode Watcher::getWatchMode() const
     {
-        // Implementation of sorting output ascending by event counts for the specified event
+        return this->watch_mode_;
     }
 
-    void Watcher::descending(const std::string &event)
+    void Watcher::setWalkerThreads(unsigned threads)
+    {
+        walker_.setThreads(threads);
+    }
+
+    void Watcher::setMaxDepth(int depth)
+    {
+        // Deepest directory level recursive() descends to, -1 for unlimited
+        walker_.setMaxDepth(depth);
+    }
+
+    void Watcher::setCoalescing(std::chrono::milliseconds window)
+    {
+        // Merge events on the same file until it has been quiet for window, 0 turns merging off
+        coalescing_window_ = std::chrono::duration_cast<std::chrono::nanoseconds>(window).count();
+        this->wakeUp();
+    }
+
+    void Watcher::setOverflowRecovery(OverflowRecovery mode)
+    {
+        // Snapshots are taken for directories watched from now on, set this before recursive()
+        overflow_recovery_ = mode;
+    }
+
+    void Watcher::setRenameWindow(std::chrono::milliseconds window)
+    {
+        // How long a MOVED_FROM waits for its MOVED_TO before it counts as a move out of the tree
+        rename_window_ = std::chrono::duration_cast<std::chrono::nanoseconds>(window).count();
+    }
+
+    void Watcher::setAutoWatchBudget(std::size_t directories)
+    {
+        // Directories scanned per event loop iteration when new subdirectories appear
+        auto_watch_budget_ = std::max<std::size_t>(directories, 1);
+    }
+
+    void Watcher::setReadBufferSize(std::size_t bytes)
+    {
+        // Picked up by the observer thread before its next read, the buffer is never resized under it
+        if (bytes < EventReader::MIN_BUFFER_SIZE)
+        {
+            spdlog::warn("Read buffer of {} bytes is too small, using {} bytes", bytes, EventReader::MIN_BUFFER_SIZE);
+            bytes = EventReader::MIN_BUFFER_SIZE;
+        }
+        read_buffer_size_ = bytes;
+    }
+
+    std::size_t Watcher::getReadBufferSize() const
     {
-        // Implementation of sorting output descending by event counts for the specified event
+        return read_buffer_size_;
     }
 
     bool Watcher::getVerbose() const
@@ -289,5 +2199,6 @@ namespace inotify
         {
             spdlog::set_level(spdlog::level::off); // Disable logging
         }
+        return this->verbose_;
     }
 }
@@ -8,78 +8,368 @@
 #include <thread>
 #include <queue>
 #include <map>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 #include <atomic>
 #include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <coroutine>
 
 #include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include "nlohmann/json.hpp"
 #include "spdlog/spdlog.h"
-#include "filesystem/file_system.hpp"
-
 #include "fmt/fmt.hpp"
+#include "filesystem/file_system.hpp"
+#include "filesystem/directory_walker.hpp"
+#include "filesystem/snapshot.hpp"
+#include "event/event_reader.hpp"
+#include "event/file_event.hpp"
+#include "event/coalescer.hpp"
+#include "event/rename_matcher.hpp"
+#include "event/dispatcher.hpp"
+#include "event/await_slot.hpp"
+#include "event/event_batch.hpp"
+#include "exec/worker_pool.hpp"
+#include "backend/backend.hpp"
+#include "backend/inotify_backend.hpp"
+#include "backend/fanotify_backend.hpp"
+#include "backend/polling_backend.hpp"
+#include "io/uring.hpp"
+#include "queue/spsc_ring.hpp"
+#include "index/watch_index.hpp"
+#include "filter/path_filter.hpp"
+#include "filter/mask_filter.hpp"
+#include "output/ndjson_writer.hpp"
+#include "output/event_encoder.hpp"
+#include "stats/event_statistics.hpp"
+#include "stats/space_saving.hpp"
 
-struct Timestamp {
-    std::chrono::system_clock::time_point time; // Time of the event occurrence
-};
+namespace inotify
+{
+    enum class WatchMode
+    {
+        DIRECTORIES, // Watch directories only, events on their entries are reported by name (one watch per directory)
+        FILES        // Directories as above plus one watch per regular file, found by recursive() or created later
+    };
 
-struct File {
-    std::filesystem::path file; // File that triggered the event
-};
+    enum class OverflowRecovery
+    {
+        OFF,    // Only report the overflow
+        ACTIVE, // Rescan directories with recent activity or a changed modification time
+        FULL    // Rescan every watched directory
+    };
 
-struct Event {
-    std::string event; // The event that occurred
-};
+    enum class ShardPolicy
+    {
+        SUBTREE,  // Everything below the same top-level directory of a recursive() root shares a shard
+        PATH_HASH // Every directory is placed by the hash of its own path
+    };
 
+    enum class HandlerOrdering
+    {
+        PATH,     // Handlers see the events of one path in order
+        DIRECTORY // Handlers see the events of one directory's entries in order
+    };
 
-namespace inotify
-{
     class Watcher
     {
     private:
-        FileSystem file_system_ = null;
-        
-        std::vector<std::filesystem::path> watch_list_;
+        struct HotPathLabel                                                    // Entry a hot file counter stands for
+        {
+            int wd = -1;
+            std::string name;
+        };
+        struct HotPathSnapshot                                                 // Copy of a shard's sketches
+        {
+            std::vector<SpaceSaving<HotPathLabel>::Counter> files;
+            std::vector<SpaceSaving<int>::Counter> directories;
+            uint64_t file_error = 0;                                           // errorBound() of the sketches
+            uint64_t directory_error = 0;
+        };
+
+        // One backend instance with its own kernel queue, reader thread and event pipeline. A directory
+        // found by auto-watch or overflow recovery stays in the shard that reported it
+        struct Shard : EventSink
+        {
+            Shard(Watcher &watcher, std::size_t id)
+                : watcher(watcher), id(id), index(watcher.paths_), index_mutex(watcher.index_mutex_),
+                  events(DEFAULT_EVENT_QUEUE_CAPACITY, static_cast<uint8_t>(id))
+            {
+            }
+            ~Shard() override
+            {
+                {
+                    std::unique_lock lock(index_mutex);
+                    index.clear();
+                }
+                close(wakeup_fd);
+                close(epoll_fd);
+            }
+
+            void directory(int wd, const std::filesystem::path &path) override
+            {
+                std::unique_lock lock(index_mutex);
+                index.insert(wd, path);
+            }
+            void event(const EventView &event, int64_t timestamp) override
+            {
+                watcher.handleEvent(*this, event, timestamp);
+            }
+
+            Watcher &watcher;
+            std::size_t id;
+            std::unique_ptr<Backend> backend;                                  // Where the events come from
+            int epoll_fd = -1;                                                 // epoll instance the reader thread blocks on
+            int wakeup_fd = -1;                                                // eventfd used to wake the reader thread
+            std::thread thread;
+
+            std::unique_ptr<Uring> uring;                                      // Replaces epoll when io_uring is on, reader thread only
+            bool read_armed = false;                                           // Poll (and linked read) on the backend queued
+            bool read_linked = false;                                          // The poll is linked to a read into backend->readBuffer()
+            int read_result = 0;                                               // Completion of the read (or poll) not handled yet
+            bool wakeup_armed = false;                                         // Poll on wakeup_fd queued
+            bool woken = false;                                                // wakeup_fd completed, not drained yet
+
+            WatchIndex index;                                                  // wd <-> path of every watch of this instance, in Watcher::paths_
+            std::shared_mutex &index_mutex;                                    // Watcher::index_mutex_, guards index and moved_watches
+            std::unordered_set<int> moved_watches;                             // Renamed watches whose MOVE_SELF is still to come
+
+            std::string event_path;                                            // Scratch buffer for the path of the event being handled
+            std::string rename_name;                                           // Scratch buffer for "old/new" rename names
+            std::string dispatch_path;                                         // Scratch buffers for the paths handed to handlers
+            std::string dispatch_from;
+            std::vector<uint64_t> dispatch_candidates;                         // Scratch bitmap of EventDispatcher::dispatch()
+
+            std::deque<std::pair<std::string, int>> pending_scans;             // New directories (path, wd) not scanned yet, reader thread only
+            std::vector<char> scan_buffer;                                     // getdents64 scratch space for pending_scans
+
+            std::unique_ptr<EventCoalescer> coalescer;                         // Merges bursts per file when coalescing is on, reader thread only
+            EventCoalescer::Emit emit;                                         // Publishes what the coalescer releases
+            RenameMatcher renames;                                             // MOVED_FROM halves waiting for their MOVED_TO, reader thread only
+
+            std::unordered_map<int, DirectorySnapshot> snapshots;              // wd -> listing cached for overflow recovery
+            std::mutex snapshot_mutex;                                         // Guards snapshots
+            std::string snapshot_path;                                         // Scratch buffer for updateSnapshot(), reader thread only
+            std::unordered_set<int> active_directories;                        // wds with events since their snapshot, reader thread only
+
+            EventStatistics statistics;                                        // Counters per wd when statistics are on, written by the reader thread only
+            std::atomic<uint32_t> statistics_resets = 0;                       // Bumped by resetStatistics()
+            std::atomic<uint32_t> statistics_applied = 0;                      // Last reset carried out by the reader thread, the table reads as empty until then
+            std::unordered_map<std::string, uint32_t> retired_keys;            // Path of a released watch -> statistics key its counts moved to, reader thread only
+            std::vector<std::filesystem::path> retired_paths;                  // Path per key from EventStatistics::RETIRED on, guarded by index_mutex
+
+            std::unique_ptr<SpaceSaving<HotPathLabel>> hot_files;              // Heavy hitters when setHotPaths() is on, reader thread only
+            std::unique_ptr<SpaceSaving<int>> hot_directories;
+            bool hot_changed = false;                                          // Counted since the last snapshot
+            int64_t hot_published = 0;                                         // When the last snapshot was taken
+            std::shared_ptr<const HotPathSnapshot> hot_snapshot;               // What getHotPaths() reads
+            std::mutex hot_mutex;                                              // Guards the hot_snapshot pointer, not the sketches
+
+            EventRing events;                                                  // Hand-off from the reader thread to the consumer
+            std::atomic<uint64_t> dropped_events = 0;                          // Events lost because the consumer fell behind
+        };
+
+        FileSystem file_system_;
+
+        PathArena paths_;                                                      // Paths of watch_list_ and of every shard's index, interned once
+        mutable std::shared_mutex index_mutex_;                                // Guards paths_, watch_list_ and the shards' indexes
+        std::unordered_map<PathArena::Id, unsigned char> watch_list_;          // Paths given to recursive() and fromFile() -> d_type from the walker, DT_UNKNOWN for fromFile() paths
         std::atomic<bool> run_watcher_thread_;
-        std::map<std::filesystem::path, std::queue<std::string>> file_events_; // Map where the first element is the path, and the second is a queue of events
-        std::thread observer_thread_;
-        std::function<void()> stored_function_;                                // In this field is stored function to call at anyevent
+        EventDispatcher dispatcher_;                                           // Handlers registered with on(), called by the reader threads
+        struct HandlerTask                                                     // Event copied for the handler pool
+        {
+            EventKind kind = EventKind::EVENT;
+            std::string path;
+            std::string from;
+            uint32_t mask = 0;
+            uint32_t cookie = 0;
+            int64_t timestamp = 0;
+        };
+        std::unique_ptr<WorkerPool<HandlerTask>> handler_pool_;                // Runs the handlers when set, otherwise the reader threads do
+        HandlerOrdering handler_ordering_ = HandlerOrdering::PATH;
+        std::atomic<bool> statistics_ = false;                                 // Reader threads count events per watch
+        std::atomic<uint32_t> statistics_mask_ = EventStatistics::COUNTED;     // Events counted, narrowed by event()
+        bool statistics_events_ = false;                                       // event() was called
+        int sort_column_ = 0;                                                  // Statistics column the table is sorted by
+        bool sort_ascending_ = false;
+        bool zero_ = false;                                                    // Table includes all-zero rows and columns
+        std::size_t hot_capacity_ = 0;                                         // Counters per sketch and shard, 0 for off
+        AwaitSlot await_slot_;                                                 // Coroutine suspended in next() or nextBatch()
+        std::atomic<bool> stopped_ = false;                                    // disable() was called, awaiters see the end of the stream
+        AwaitSlot::Resumer resumer_;                                           // Resumes it on the consumer's executor, inline if empty
+        std::deque<FileEvent> awaited_;                                        // Drained but not yet returned by next(), consumer only
+        std::shared_ptr<EventBatchPool> batch_pool_ = std::make_shared<EventBatchPool>(); // Recycles the batches of drainBatch()
         
         bool verbose_;                                                         // Add verbose flag
         bool recursive_mode_ = false;
-        bool running_ = false;
-        int fd_;                                                               // file descriptor for inotify
+        WatchMode watch_mode_ = WatchMode::DIRECTORIES;
+        DirectoryWalker walker_;                                               // Lists the tree for recursive()
+        PathFilter filter_;                                                    // exclude()/excludeGlob() patterns, applied while traversing and per event
+        mutable std::shared_mutex filter_mutex_;                               // Guards filter_, read by every reader thread
+
+        static constexpr int MAX_EPOLL_EVENTS = 2;                             // Backend descriptor and wakeup eventfd
+        static constexpr unsigned URING_ENTRIES = 256;                         // Submission queue size, bounds a scan batch
+        static constexpr uint64_t URING_POLL = 1;                              // user_data of the reader thread's own requests
+        static constexpr uint64_t URING_READ = 2;
+        static constexpr uint64_t URING_WAKEUP = 3;
+        static constexpr uint64_t URING_CANCEL = 4;
+        static constexpr int64_t HOT_PATHS_INTERVAL = 100000000;               // Nanoseconds between snapshots of the sketches
 
-        void observeFiles();
+        std::vector<std::unique_ptr<Shard>> shards_;                           // Fixed while the reader threads run
+        BackendType backend_type_ = BackendType::INOTIFY;
+        FanotifyMark fanotify_mark_ = FanotifyMark::FILESYSTEM;
+        int64_t poll_min_interval_ = PollingBackend::DEFAULT_MIN_INTERVAL;
+        int64_t poll_max_interval_ = PollingBackend::DEFAULT_MAX_INTERVAL;
+        ShardPolicy shard_policy_ = ShardPolicy::SUBTREE;
+        bool pin_shards_ = true;                                               // Pin each reader thread to its own core
+        bool ordered_output_ = true;                                           // getCurrentEvents() merges the shards by time
+        std::atomic<bool> use_io_uring_ = false;                               // Reader threads wait and scan through io_uring
 
+        std::atomic<std::size_t> read_buffer_size_ = EventReader::DEFAULT_BUFFER_SIZE; // Requested size, applied by the reader threads
+        std::atomic<std::size_t> auto_watch_budget_ = DEFAULT_AUTO_WATCH_BUDGET; // Directories scanned per loop iteration
+        std::atomic<int64_t> coalescing_window_ = 0;                           // Requested quiet window in nanoseconds, 0 for off
+        std::atomic<int64_t> rename_window_ = RenameMatcher::DEFAULT_WINDOW;   // Requested pairing window in nanoseconds
+        std::atomic<OverflowRecovery> overflow_recovery_ = OverflowRecovery::OFF;
 
+        std::unique_ptr<Shard> createShard(std::size_t id);
+        void rebuildShards(std::size_t count);
+        std::string_view shardKey(std::string_view root, std::string_view path) const;
+        Shard &shardFor(std::string_view key);
+        void pinShards();
+        void stop(bool final);
+        void observeFiles(Shard &shard);
+        bool waitEpoll(Shard &shard, int timeout);
+        bool waitUring(Shard &shard, int timeout);
+        void uringCompletion(Shard &shard, uint64_t user_data, int result);
+        void stopUring(Shard &shard);
+        void drainWakeup(Shard &shard);
+        void handleEvent(Shard &shard, const EventView &event, int64_t timestamp);
+        void dispatch(Shard &shard, int64_t timestamp, int wd, uint32_t mask, uint32_t cookie, std::string_view name, EventKind kind, int from_wd);
+        void count(Shard &shard, int wd, uint32_t mask, EventKind kind, int from_wd);
+        void retireStatistics(Shard &shard, int wd);
+        void track(Shard &shard, int wd, std::string_view name, EventKind kind, int from_wd);
+        void snapshotHotPaths(Shard &shard, int64_t now);
+        void publish(Shard &shard, int64_t timestamp, int wd, uint32_t mask, uint32_t cookie, std::string_view name,
+                     EventKind kind = EventKind::EVENT, int from_wd = -1);
+        void scanNewDirectories(Shard &shard);
+        bool scanBatched(Shard &shard, const std::vector<std::pair<std::string, int>> &directories,
+                         const std::function<void(const std::string &, int, std::string_view, unsigned char)> &found);
+        void applyCoalescing(Shard &shard);
+        void publishRename(Shard &shard, const RenameMatcher::Pending &from, const EventView &to);
+        void expireRenames(Shard &shard, bool all);
+        void releaseSubtree(const std::filesystem::path &path, bool erase);
+        void recoverOverflow(Shard &shard, int64_t timestamp);
+        void captureSnapshots(Shard &shard, const std::vector<std::pair<int, std::string>> &directories);
+        void updateSnapshot(Shard &shard, int wd, std::string_view name);
+        int addWatch(Shard &shard, const std::filesystem::path &path);
+        int addWatch(const std::filesystem::path &path);
+        void removeWatch(const std::filesystem::path &path);
+        bool listWatch(std::string_view path, unsigned char type);
+        bool unlistWatch(std::string_view path);
+        void pruneWatchList();
+        void wakeUp();
+        bool hasEvents() const;
+        void resolvePath(const Shard &shard, int wd, std::string_view name, EventKind kind, int from_wd, std::string &path, std::string &from) const;
+        void takeEvents(std::size_t limit, std::vector<FileEvent> &events);
 
     public:
+        static constexpr std::size_t DEFAULT_EVENT_QUEUE_CAPACITY = 16384;
+        static constexpr std::size_t DEFAULT_AUTO_WATCH_BUDGET = 64;
+
         Watcher();
-        void enable()
+        void enable();
+        std::size_t watch(NdjsonWriter &writer, std::size_t limit = SIZE_MAX);
+        std::size_t exportEvents(EventEncoder &encoder, std::size_t limit = SIZE_MAX);
+        EventBatchPool::Handle drainBatch(std::size_t limit = SIZE_MAX);
+        std::vector<FileEvent> getCurrentEvents();
+        template <typename Callable>
+        std::size_t consumeEvents(Callable &&func, std::size_t limit = SIZE_MAX) // func(const EventRecord &, std::string_view name), no allocation
+        {
+            // Shard by shard, record.shard tells which instance the wds belong to
+            std::size_t count = 0;
+            for (auto &shard : shards_)
+            {
+                count += shard->events.consume(func, limit - count);
+            }
+            return count;
+        }
+        template <typename Callable>
+        std::size_t consumeShardEvents(std::size_t shard, Callable &&func, std::size_t limit = SIZE_MAX) // One consumer thread per shard
         {
-            this->run_watcher_thread_ = true;
-            spdlog::info("Watcher enabled");
+            return shards_.at(shard)->events.consume(std::forward<Callable>(func), limit);
         }
-        nlohmann::json watch() const;
+        uint64_t getDroppedEvents() const;
+
+        // co_await watcher.next() yields the next event, std::nullopt once the watcher is disabled
+        class NextAwaiter
+        {
+        public:
+            explicit NextAwaiter(Watcher &watcher) : watcher_(watcher) {}
+            bool await_ready() const { return !watcher_.awaited_.empty() || watcher_.hasEvents() || watcher_.stopped_; }
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                return watcher_.await_slot_.park(handle, [this]() { return this->await_ready(); });
+            }
+            std::optional<FileEvent> await_resume();
+
+        private:
+            Watcher &watcher_;
+        };
+
+        // co_await watcher.nextBatch() yields up to limit events per resumption, empty once the watcher is disabled
+        class BatchAwaiter
+        {
+        public:
+            BatchAwaiter(Watcher &watcher, std::size_t limit) : watcher_(watcher), limit_(limit) {}
+            bool await_ready() const { return !watcher_.awaited_.empty() || watcher_.hasEvents() || watcher_.stopped_; }
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                return watcher_.await_slot_.park(handle, [this]() { return this->await_ready(); });
+            }
+            std::vector<FileEvent> await_resume();
+
+        private:
+            Watcher &watcher_;
+            std::size_t limit_;
+        };
+
+        NextAwaiter next() { return NextAwaiter(*this); }                        // One awaiting coroutine at a time
+        BatchAwaiter nextBatch(std::size_t limit = SIZE_MAX) { return BatchAwaiter(*this, limit); }
+        void setResumer(AwaitSlot::Resumer resumer);
         template <typename Callable>
-        void call(Callable &&func) // Changed return type to void
+        EventDispatcher::HandlerId on(uint32_t mask, std::string_view pattern, Callable &&func) // func(const EventRef &) on the reader thread
         {
-            stored_function_ = func; // Store function instead of calling it
+            return dispatcher_.add(mask, pattern, std::forward<Callable>(func));
         }
-        void disable()
+        template <typename Callable>
+        EventDispatcher::HandlerId call(Callable &&func) // Every event on every path
         {
-            this->run_watcher_thread_ = false;
-            spdlog::info("Watcher disabled");
+            return this->on(IN_ALL_EVENTS | IN_Q_OVERFLOW | IN_IGNORED, {}, std::forward<Callable>(func));
         }
+        bool off(EventDispatcher::HandlerId id);
+        void setHandlerThreads(unsigned threads, HandlerOrdering ordering = HandlerOrdering::PATH, std::size_t lanes = 0);
+        WorkerPoolStats getHandlerStats() const;
+        void disable();
         ~Watcher()
         {
             spdlog::warn("Object has been deleted"); // Log warning that the object has been deleted
+            this->disable();
+            handler_pool_.reset();                   // Runs the handlers still queued
+            shards_.clear();                         // Closes the inotify instances
             spdlog::shutdown();                      // Stop logging
-            run_watcher_thread_ = false;
-            if (observer_thread_.joinable())
-            {
-                observer_thread_.join();
-            }
         }
 
         //syf
@@ -88,20 +378,37 @@ namespace inotify
         void zero();
         void exclude(const std::string &pattern);
         void excludei(const std::string &pattern);
+        void excludeGlob(const std::string &pattern, bool icase = false);
+        void includeGlob(const std::string &pattern);
         void recursive(const std::string &path);
         void timeout(int seconds);
         void event(const std::string &event);
         void ascending(const std::string &event);
         void descending(const std::string &event);
+        void setStatistics(bool enabled);
+        std::vector<StatisticsRow> getStatistics(std::size_t limit = SIZE_MAX);
+        std::string formatStatistics(std::size_t limit = SIZE_MAX);
+        void resetStatistics();
+        void setHotPaths(std::size_t capacity);
+        std::vector<HotPath> getHotPaths(std::size_t k, HotPathKind kind = HotPathKind::FILES);
+        void setShards(unsigned count, ShardPolicy policy = ShardPolicy::SUBTREE, bool pin = true);
+        std::size_t getShardCount() const;
+        void setBackend(BackendType type, FanotifyMark mark = FanotifyMark::FILESYSTEM);
+        BackendType getBackend() const;
+        void setPollInterval(std::chrono::milliseconds min, std::chrono::milliseconds max);
+        bool setIoUring(bool enabled);
+        void setOrderedOutput(bool ordered);
+        void setWatchMode(WatchMode mode);
+        WatchMode getWatchMode() const;
+        void setWalkerThreads(unsigned threads);
+        void setMaxDepth(int depth);
+        void setCoalescing(std::chrono::milliseconds window);
+        void setOverflowRecovery(OverflowRecovery mode);
+        void setRenameWindow(std::chrono::milliseconds window);
+        void setAutoWatchBudget(std::size_t directories);
+        void setReadBufferSize(std::size_t bytes);
+        std::size_t getReadBufferSize() const;
         bool setVerbose(bool value);
         bool getVerbose() const;
     };
 }
-
-// void callcall() // Added method to call stored function
-//         {
-//             if(stored_function_) // Check if function is stored
-//             {
-//                 stored_function_(); // Call stored function
-//             }
-//         }
\ No newline at end of file
@@ -0,0 +1,309 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../nlohmann/json.hpp"
+#include "time_formatter.hpp"
+#include "../event/file_event.hpp"
+
+namespace inotify
+{
+    enum class BinaryFormat
+    {
+        CBOR,    // RFC 8949, written by nlohmann's binary_writer
+        MSGPACK, // MessagePack, written by nlohmann's binary_writer
+        RAW      // Fixed-layout records, see RawBatchHeader
+    };
+
+    // Layout of a BinaryFormat::RAW batch, host byte order, no padding between the parts:
+    //   RawBatchHeader, RawDirectory[directories], RawEvent[events], string bytes[strings]
+    // Offsets point into the string bytes
+    struct RawBatchHeader
+    {
+        static constexpr uint32_t MAGIC = 0x56454e49; // "INEV" read as little-endian
+        static constexpr uint16_t VERSION = 1;
+
+        uint32_t magic = MAGIC;
+        uint16_t version = VERSION;
+        uint16_t header_size = sizeof(RawBatchHeader);
+        uint32_t events = 0;
+        uint32_t directories = 0;
+        uint32_t strings = 0;      // Bytes
+        uint32_t reserved = 0;
+    };
+
+    struct RawDirectory
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct RawEvent
+    {
+        int64_t time;              // Wall-clock nanoseconds since the epoch
+        uint32_t mask;
+        uint32_t cookie;
+        uint32_t directory;        // Index into the directory table
+        uint32_t name_offset;
+        uint32_t from_directory;   // RENAME only, otherwise NO_DIRECTORY
+        uint32_t from_name_offset;
+        uint16_t name_length;
+        uint16_t from_name_length;
+        uint8_t kind;              // EventKind
+        uint8_t reserved[3];
+
+        static constexpr uint32_t NO_DIRECTORY = UINT32_MAX;
+    };
+    static_assert(sizeof(RawBatchHeader) == 24 && sizeof(RawDirectory) == 8 && sizeof(RawEvent) == 40, "Wire layout changed");
+
+    // Collects a batch of events and encodes it for another process. Paths are split into the
+    // directory, stored once per batch in a dictionary, and the entry name. CBOR and MessagePack batches are
+    //   {"v":1, "t":<wall-clock ns of the first event>, "d":[directories...], "e":[events...]}
+    // with each event an array [time - t, mask, directory, name] or, for renames and events with a
+    // cookie, [time - t, mask, directory, name, cookie, kind, from directory, from name].
+    // The instance is reused: encode() produces the bytes, clear() starts the next batch
+    class EventEncoder
+    {
+    private:
+        struct Entry
+        {
+            int64_t time;
+            uint32_t mask;
+            uint32_t cookie;
+            uint32_t directory;
+            uint32_t name_offset;
+            uint32_t from_directory;
+            uint32_t from_name_offset;
+            uint16_t name_length;
+            uint16_t from_name_length;
+            EventKind kind;
+        };
+
+        struct StringHash
+        {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view value) const { return std::hash<std::string_view>{}(value); }
+        };
+
+        BinaryFormat format_;
+        TimeFormatter clock_{TimeZone::UTC};
+        std::vector<Entry> entries_;
+        std::string names_;                                  // Entry names, back to back
+        std::vector<std::string_view> directories_;          // Views into directory_index_ keys
+        std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> directory_index_;
+        std::vector<uint8_t> output_;
+        nlohmann::json batch_;
+
+        uint32_t directory(std::string_view path)
+        {
+            auto found = directory_index_.find(path);
+            if (found == directory_index_.end())
+            {
+                found = directory_index_.emplace(std::string(path), static_cast<uint32_t>(directories_.size())).first;
+                directories_.push_back(found->first);
+            }
+            return found->second;
+        }
+
+        uint32_t name(std::string_view text)
+        {
+            auto offset = static_cast<uint32_t>(names_.size());
+            names_.append(text);
+            return offset;
+        }
+
+        template <typename T>
+        void put(const T &value)
+        {
+            const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+            output_.insert(output_.end(), bytes, bytes + sizeof(T));
+        }
+
+        void encodeRaw()
+        {
+            // Directory names go first in the string bytes, entry names follow
+            uint32_t directory_bytes = 0;
+            for (std::string_view directory : directories_)
+            {
+                directory_bytes += static_cast<uint32_t>(directory.size());
+            }
+            RawBatchHeader header;
+            header.events = static_cast<uint32_t>(entries_.size());
+            header.directories = static_cast<uint32_t>(directories_.size());
+            header.strings = directory_bytes + static_cast<uint32_t>(names_.size());
+            output_.reserve(sizeof(header) + directories_.size() * sizeof(RawDirectory) + entries_.size() * sizeof(RawEvent) + header.strings);
+            this->put(header);
+
+            uint32_t offset = 0;
+            for (std::string_view directory : directories_)
+            {
+                this->put(RawDirectory{offset, static_cast<uint32_t>(directory.size())});
+                offset += static_cast<uint32_t>(directory.size());
+            }
+            for (const Entry &entry : entries_)
+            {
+                RawEvent event = {};
+                event.time = entry.time;
+                event.mask = entry.mask;
+                event.cookie = entry.cookie;
+                event.directory = entry.directory;
+                event.name_offset = directory_bytes + entry.name_offset;
+                event.from_directory = entry.from_directory;
+                event.from_name_offset = directory_bytes + entry.from_name_offset;
+                event.name_length = entry.name_length;
+                event.from_name_length = entry.from_name_length;
+                event.kind = static_cast<uint8_t>(entry.kind);
+                this->put(event);
+            }
+            for (std::string_view directory : directories_)
+            {
+                output_.insert(output_.end(), directory.begin(), directory.end());
+            }
+            output_.insert(output_.end(), names_.begin(), names_.end());
+        }
+
+        void encodeDocument()
+        {
+            // One value per batch; the binary writers size every integer to its smallest encoding,
+            // which is what makes the time deltas and dictionary indexes pay off
+            int64_t base = entries_.empty() ? 0 : entries_.front().time;
+            batch_ = nlohmann::json::object();
+            batch_["v"] = 1;
+            batch_["t"] = base;
+            nlohmann::json &directories = batch_["d"] = nlohmann::json::array();
+            for (std::string_view directory : directories_)
+            {
+                directories.push_back(directory);
+            }
+            nlohmann::json &events = batch_["e"] = nlohmann::json::array();
+            events.get_ref<nlohmann::json::array_t &>().reserve(entries_.size());
+            std::string_view names = names_;
+            for (const Entry &entry : entries_)
+            {
+                nlohmann::json &event = events.emplace_back(nlohmann::json::array({entry.time - base, entry.mask, entry.directory,
+                                                                                   names.substr(entry.name_offset, entry.name_length)}));
+                if (entry.kind != EventKind::EVENT || entry.cookie != 0)
+                {
+                    event.push_back(entry.cookie);
+                    event.push_back(static_cast<int>(entry.kind));
+                    if (entry.from_directory != RawEvent::NO_DIRECTORY)
+                    {
+                        event.push_back(entry.from_directory);
+                    }
+                    else
+                    {
+                        event.push_back(nullptr);
+                    }
+                    event.push_back(names.substr(entry.from_name_offset, entry.from_name_length));
+                }
+            }
+            if (format_ == BinaryFormat::CBOR)
+            {
+                nlohmann::json::to_cbor(batch_, output_);
+            }
+            else
+            {
+                nlohmann::json::to_msgpack(batch_, output_);
+            }
+        }
+
+    public:
+        explicit EventEncoder(BinaryFormat format = BinaryFormat::CBOR) : format_(format) {}
+
+        // directory is the watched directory the event was reported for, name the entry within it
+        // (empty for the directory itself). timestamp is in steady_clock nanoseconds as in EventRecord
+        void add(EventKind kind, std::string_view directory, std::string_view name, std::string_view from_directory,
+                 std::string_view from_name, uint32_t mask, uint32_t cookie, int64_t timestamp)
+        {
+            Entry entry;
+            entry.time = clock_.wallTime(timestamp);
+            entry.mask = mask;
+            entry.cookie = cookie;
+            entry.directory = this->directory(directory);
+            entry.name_offset = this->name(name);
+            entry.name_length = static_cast<uint16_t>(name.size());
+            entry.from_directory = kind == EventKind::RENAME ? this->directory(from_directory) : RawEvent::NO_DIRECTORY;
+            entry.from_name_offset = this->name(from_name);
+            entry.from_name_length = static_cast<uint16_t>(from_name.size());
+            entry.kind = kind;
+            entries_.push_back(entry);
+        }
+
+        // Encodes the events added since clear(), the result stays valid until the next call
+        const std::vector<uint8_t> &encode()
+        {
+            output_.clear();
+            if (format_ == BinaryFormat::RAW)
+            {
+                this->encodeRaw();
+            }
+            else
+            {
+                this->encodeDocument();
+            }
+            return output_;
+        }
+
+        // Keeps the allocated capacity for the next batch
+        void clear()
+        {
+            entries_.clear();
+            names_.clear();
+            directories_.clear();
+            directory_index_.clear();
+        }
+
+        std::size_t size() const { return entries_.size(); }
+        bool empty() const { return entries_.empty(); }
+        BinaryFormat format() const { return format_; }
+
+        // Reads a BinaryFormat::RAW batch, func(EventKind, std::string_view directory, std::string_view
+        // name, std::string_view from_directory, std::string_view from_name, uint32_t mask, uint32_t cookie,
+        // int64_t time) per event. False if data is not a complete batch
+        template <typename Callable>
+        static bool decodeRaw(const uint8_t *data, std::size_t size, Callable &&func)
+        {
+            RawBatchHeader header;
+            if (size < sizeof(header))
+            {
+                return false;
+            }
+            std::memcpy(&header, data, sizeof(header));
+            std::size_t directories = header.header_size;
+            std::size_t events = directories + std::size_t(header.directories) * sizeof(RawDirectory);
+            std::size_t strings = events + std::size_t(header.events) * sizeof(RawEvent);
+            if (header.magic != RawBatchHeader::MAGIC || header.version != RawBatchHeader::VERSION ||
+                header.header_size < sizeof(header) || strings + header.strings > size)
+            {
+                return false;
+            }
+            std::string_view text(reinterpret_cast<const char *>(data + strings), header.strings);
+            auto directory = [&](uint32_t index) -> std::string_view
+            {
+                if (index >= header.directories)
+                {
+                    return {};
+                }
+                RawDirectory entry;
+                std::memcpy(&entry, data + directories + index * sizeof(RawDirectory), sizeof(entry));
+                return entry.offset <= text.size() ? text.substr(entry.offset, entry.length) : std::string_view();
+            };
+            auto slice = [&](uint32_t offset, uint16_t length)
+            {
+                return offset <= text.size() ? text.substr(offset, length) : std::string_view();
+            };
+            for (uint32_t i = 0; i < header.events; ++i)
+            {
+                RawEvent event;
+                std::memcpy(&event, data + events + i * sizeof(RawEvent), sizeof(event));
+                func(static_cast<EventKind>(event.kind), directory(event.directory), slice(event.name_offset, event.name_length),
+                     directory(event.from_directory), slice(event.from_name_offset, event.from_name_length), event.mask, event.cookie, event.time);
+            }
+            return true;
+        }
+    };
+}
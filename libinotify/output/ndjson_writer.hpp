@@ -0,0 +1,192 @@
+#pragma once
+#include <unistd.h>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "time_formatter.hpp"
+#include "../event/file_event.hpp"
+
+namespace inotify
+{
+    // Serializes events as newline-delimited JSON straight into a reusable buffer, one object per line:
+    //   {"time":"2024-05-01T14:00:00.000000123+02:00","kind":"event","mask":"CREATE|ISDIR","path":"/srv/a"}
+    // Renames add "from" and "cookie". Paths that are not valid UTF-8 get U+FFFD for the offending
+    // bytes, so every line parses. With a descriptor the buffer is written out whenever it grows past
+    // FLUSH_THRESHOLD and on flush(), otherwise the caller takes it with view() and clear()
+    class NdjsonWriter
+    {
+    private:
+        std::string buffer_;
+        TimeFormatter time_;
+        int fd_;
+
+        void appendString(std::string_view text)
+        {
+            static constexpr char HEX[] = "0123456789abcdef";
+            buffer_ += '"';
+            std::size_t i = 0;
+            while (i < text.size())
+            {
+                auto byte = static_cast<unsigned char>(text[i]);
+                if (byte >= 0x80)
+                {
+                    std::size_t length = utf8Length(text.substr(i));
+                    if (length == 0)
+                    {
+                        buffer_ += "\xef\xbf\xbd";
+                        ++i;
+                    }
+                    else
+                    {
+                        buffer_.append(text.substr(i, length));
+                        i += length;
+                    }
+                    continue;
+                }
+                if (byte == '"' || byte == '\\')
+                {
+                    buffer_ += '\\';
+                    buffer_ += static_cast<char>(byte);
+                }
+                else if (byte < 0x20)
+                {
+                    char escape[6] = {'\\', 'u', '0', '0', HEX[byte >> 4], HEX[byte & 15]};
+                    buffer_.append(escape, sizeof(escape));
+                }
+                else
+                {
+                    buffer_ += static_cast<char>(byte);
+                }
+                ++i;
+            }
+            buffer_ += '"';
+        }
+
+        // Length of the well-formed UTF-8 sequence text starts with, 0 if it is not one
+        static std::size_t utf8Length(std::string_view text)
+        {
+            auto byte = [&](std::size_t i) { return static_cast<unsigned char>(text[i]); };
+            std::size_t length = byte(0) >= 0xf0 ? 4 : byte(0) >= 0xe0 ? 3 : byte(0) >= 0xc2 ? 2 : 0;
+            if (length == 0 || length > text.size() || byte(0) > 0xf4)
+            {
+                return 0;
+            }
+            for (std::size_t i = 1; i < length; ++i)
+            {
+                if ((byte(i) & 0xc0) != 0x80)
+                {
+                    return 0;
+                }
+            }
+            // Overlong forms, surrogates and code points past U+10FFFF
+            if ((byte(0) == 0xe0 && byte(1) < 0xa0) || (byte(0) == 0xed && byte(1) >= 0xa0) ||
+                (byte(0) == 0xf0 && byte(1) < 0x90) || (byte(0) == 0xf4 && byte(1) >= 0x90))
+            {
+                return 0;
+            }
+            return length;
+        }
+
+        void appendNumber(uint64_t value)
+        {
+            char digits[20];
+            auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            buffer_.append(digits, result.ptr);
+        }
+
+        void appendMask(uint32_t mask)
+        {
+            buffer_ += '"';
+            bool first = true;
+            for (const auto &[bit, name] : MASK_NAMES)
+            {
+                if (mask & bit)
+                {
+                    if (!first)
+                    {
+                        buffer_ += '|';
+                    }
+                    buffer_ += name;
+                    first = false;
+                }
+            }
+            buffer_ += '"';
+        }
+
+    public:
+        static constexpr std::size_t FLUSH_THRESHOLD = 64 * 1024;
+
+        // fd may be a file, pipe or socket; -1 keeps the output in the buffer
+        explicit NdjsonWriter(int fd = -1, TimeZone zone = TimeZone::LOCAL, int offset_minutes = 0)
+            : time_(zone, offset_minutes), fd_(fd)
+        {
+            buffer_.reserve(FLUSH_THRESHOLD + 4096);
+        }
+
+        // timestamp is in steady_clock nanoseconds as in EventRecord, from is only written when not empty
+        void add(EventKind kind, std::string_view path, std::string_view from, uint32_t mask, uint32_t cookie, int64_t timestamp)
+        {
+            buffer_ += "{\"time\":\"";
+            time_.append(buffer_, timestamp);
+            buffer_ += "\",\"kind\":\"";
+            buffer_ += kind == EventKind::RENAME ? "rename" : kind == EventKind::OVERFLOW ? "overflow" : "event";
+            buffer_ += "\",\"mask\":";
+            this->appendMask(mask);
+            buffer_ += ",\"path\":";
+            this->appendString(path);
+            if (!from.empty())
+            {
+                buffer_ += ",\"from\":";
+                this->appendString(from);
+            }
+            if (cookie != 0)
+            {
+                buffer_ += ",\"cookie\":";
+                this->appendNumber(cookie);
+            }
+            buffer_ += "}\n";
+
+            if (fd_ >= 0 && buffer_.size() >= FLUSH_THRESHOLD)
+            {
+                this->flush();
+            }
+        }
+
+        void add(const FileEvent &event)
+        {
+            this->add(event.kind, event.path.native(), event.from.native(), event.mask, event.cookie,
+                      std::chrono::duration_cast<std::chrono::nanoseconds>(event.time.time_since_epoch()).count());
+        }
+
+        // Writes the buffer to the descriptor, retrying short writes. False on error (errno is kept),
+        // what was not written stays in the buffer
+        bool flush()
+        {
+            std::size_t written = 0;
+            while (fd_ >= 0 && written < buffer_.size())
+            {
+                ssize_t result = ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+                if (result < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    buffer_.erase(0, written);
+                    return false;
+                }
+                written += static_cast<std::size_t>(result);
+            }
+            buffer_.erase(0, written);
+            return true;
+        }
+
+        std::string_view view() const { return buffer_; }
+        void clear() { buffer_.clear(); }
+        int descriptor() const { return fd_; }
+        TimeFormatter &timeFormatter() { return time_; }
+    };
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+namespace inotify
+{
+    enum class TimeZone
+    {
+        UTC,   // "2024-05-01T12:00:00.000000123Z"
+        LOCAL, // Offset of the process time zone (TZ) at that moment, "2024-05-01T14:00:00.000000123+02:00"
+        FIXED  // A fixed offset from UTC given in minutes
+    };
+
+    // Formats steady_clock event timestamps as ISO 8601 wall-clock time. Everything up to the
+    // seconds, time zone offset included, is cached per second, an event within the same second
+    // costs the nanosecond digits only. Not thread safe, one per writer
+    class TimeFormatter
+    {
+    private:
+        TimeZone zone_;
+        int offset_minutes_;
+        int64_t wall_offset_ = 0;     // system_clock - steady_clock, nanoseconds
+        int64_t cached_second_ = INT64_MIN;
+        char prefix_[24];             // "YYYY-MM-DDTHH:MM:SS"
+        std::size_t prefix_length_ = 0;
+        char suffix_[8];              // "Z" or "+HH:MM"
+        std::size_t suffix_length_ = 0;
+
+        void formatSecond(int64_t second)
+        {
+            time_t time = static_cast<time_t>(second);
+            struct tm parts;
+            int offset = 0;
+            if (zone_ == TimeZone::LOCAL)
+            {
+                localtime_r(&time, &parts);
+                offset = static_cast<int>(parts.tm_gmtoff / 60);
+            }
+            else
+            {
+                offset = zone_ == TimeZone::FIXED ? offset_minutes_ : 0;
+                time += static_cast<time_t>(offset) * 60;
+                gmtime_r(&time, &parts);
+            }
+            prefix_length_ = std::snprintf(prefix_, sizeof(prefix_), "%04d-%02d-%02dT%02d:%02d:%02d", parts.tm_year + 1900,
+                                           parts.tm_mon + 1, parts.tm_mday, parts.tm_hour, parts.tm_min, parts.tm_sec);
+            if (zone_ == TimeZone::UTC)
+            {
+                suffix_[0] = 'Z';
+                suffix_length_ = 1;
+            }
+            else
+            {
+                int magnitude = offset < 0 ? -offset : offset;
+                suffix_length_ = std::snprintf(suffix_, sizeof(suffix_), "%c%02d:%02d", offset < 0 ? '-' : '+', magnitude / 60 % 100, magnitude % 60);
+            }
+            cached_second_ = second;
+        }
+
+    public:
+        explicit TimeFormatter(TimeZone zone = TimeZone::LOCAL, int offset_minutes = 0)
+            : zone_(zone), offset_minutes_(offset_minutes)
+        {
+            this->calibrate();
+        }
+
+        // Re-reads the distance between the steady and the wall clock, after the wall clock was set
+        void calibrate()
+        {
+            int64_t system = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            int64_t steady = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            wall_offset_ = system - steady;
+        }
+
+        // Wall-clock nanoseconds since the epoch of a steady_clock timestamp
+        int64_t wallTime(int64_t steady) const
+        {
+            return steady + wall_offset_;
+        }
+
+        // Appends the wall-clock time of a steady_clock timestamp in nanoseconds
+        void append(std::string &out, int64_t steady)
+        {
+            int64_t wall = this->wallTime(steady);
+            int64_t second = wall >= 0 ? wall / 1000000000 : (wall - 999999999) / 1000000000;
+            int64_t nanoseconds = wall - second * 1000000000;
+            if (second != cached_second_)
+            {
+                this->formatSecond(second);
+            }
+            out.append(prefix_, prefix_length_);
+            char digits[10] = {'.'};
+            for (int i = 9; i > 0; --i)
+            {
+                digits[i] = static_cast<char>('0' + nanoseconds % 10);
+                nanoseconds /= 10;
+            }
+            out.append(digits, sizeof(digits));
+            out.append(suffix_, suffix_length_);
+        }
+    };
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include "spsc_ring.hpp"
+
+namespace inotify
+{
+    // Bounded multi-producer/multi-consumer queue (Vyukov's sequence-numbered ring), used when one
+    // stream of events is fanned out to several consumer threads. Capacity is rounded up to a power of two.
+    template <typename T>
+    class MpmcRing
+    {
+    private:
+        struct alignas(CACHE_LINE_SIZE) Cell
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> cells_;
+        std::size_t mask_;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> head_ = 0; // Next position to enqueue
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> tail_ = 0; // Next position to dequeue
+
+    public:
+        explicit MpmcRing(std::size_t capacity)
+            : cells_(std::make_unique<Cell[]>(std::bit_ceil(capacity < 2 ? std::size_t(2) : capacity))),
+              mask_(std::bit_ceil(capacity < 2 ? std::size_t(2) : capacity) - 1)
+        {
+            for (std::size_t i = 0; i <= mask_; ++i)
+            {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpmcRing(const MpmcRing &) = delete;
+        MpmcRing &operator=(const MpmcRing &) = delete;
+
+        template <typename U>
+        bool push(U &&value)
+        {
+            std::size_t position = head_.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = cells_[position & mask_];
+                std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+                if (difference == 0)
+                {
+                    if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.value = std::forward<U>(value);
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false; // Full
+                }
+                else
+                {
+                    position = head_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool pop(T &value)
+        {
+            std::size_t position = tail_.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = cells_[position & mask_];
+                std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+                if (difference == 0)
+                {
+                    if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        value = std::move(cell.value);
+                        cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false; // Empty
+                }
+                else
+                {
+                    position = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Approximate when called concurrently
+        std::size_t size() const
+        {
+            std::size_t head = head_.load(std::memory_order_acquire);
+            std::size_t tail = tail_.load(std::memory_order_acquire);
+            return head > tail ? head - tail : 0;
+        }
+        bool empty() const { return size() == 0; }
+        std::size_t capacity() const { return mask_ + 1; }
+    };
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+
+namespace inotify
+{
+    inline constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+    // Bounded single-producer/single-consumer queue. Capacity is rounded up to a power of two.
+    // Head and tail live on separate cache lines and each side keeps a cached copy of the other
+    // index, so in the common case push and pop touch no shared cache line but the slot itself.
+    template <typename T>
+    class SpscRing
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "SpscRing stores trivially copyable records");
+
+    private:
+        std::unique_ptr<T[]> slots_;
+        std::size_t mask_;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> head_ = 0; // Next slot to write, owned by the producer
+        std::size_t cached_tail_ = 0;                                // Producer's last view of tail_
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> tail_ = 0; // Next slot to read, owned by the consumer
+        std::size_t cached_head_ = 0;                                // Consumer's last view of head_
+
+    public:
+        explicit SpscRing(std::size_t capacity)
+            : slots_(std::make_unique<T[]>(std::bit_ceil(capacity < 2 ? std::size_t(2) : capacity))),
+              mask_(std::bit_ceil(capacity < 2 ? std::size_t(2) : capacity) - 1)
+        {
+        }
+
+        SpscRing(const SpscRing &) = delete;
+        SpscRing &operator=(const SpscRing &) = delete;
+
+        // Producer side
+        bool push(const T &value)
+        {
+            std::size_t head = head_.load(std::memory_order_relaxed);
+            if (head - cached_tail_ > mask_)
+            {
+                cached_tail_ = tail_.load(std::memory_order_acquire);
+                if (head - cached_tail_ > mask_)
+                {
+                    return false;
+                }
+            }
+            slots_[head & mask_] = value;
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side, the returned pointer stays valid until pop()
+        const T *front()
+        {
+            std::size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail == cached_head_)
+            {
+                cached_head_ = head_.load(std::memory_order_acquire);
+                if (tail == cached_head_)
+                {
+                    return nullptr;
+                }
+            }
+            return &slots_[tail & mask_];
+        }
+
+        void pop()
+        {
+            tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool pop(T &value)
+        {
+            const T *slot = front();
+            if (slot == nullptr)
+            {
+                return false;
+            }
+            value = *slot;
+            pop();
+            return true;
+        }
+
+        // Approximate when called concurrently with the other side
+        std::size_t size() const
+        {
+            return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+        }
+        bool empty() const { return size() == 0; }
+        std::size_t capacity() const { return mask_ + 1; }
+    };
+
+    // Compact record handed from the observer thread to the consumer, 32 bytes
+    struct EventRecord
+    {
+        int64_t timestamp;    // CLOCK_MONOTONIC nanoseconds when the event was read
+        int32_t wd;           // Watch descriptor the event was reported on
+        uint32_t mask;        // Event mask
+        uint32_t cookie;      // Cookie pairing IN_MOVED_FROM with IN_MOVED_TO
+        uint32_t name_offset; // Offset of the entry name in the ring's name buffer
+        uint16_t name_length; // Length of the entry name, 0 for the watched object itself
+        uint8_t kind = 0;     // EventKind of the record
+        uint8_t shard = 0;    // Inotify instance the wds belong to
+        int32_t from_wd = -1; // For a rename, directory the entry was moved from. The name is then "old/new"
+    };
+    static_assert(sizeof(EventRecord) == 32);
+
+    // SPSC hand-off of events together with their names. Names are copied into a byte ring next to
+    // the record ring, never split across its end, and released when the consumer pops the record.
+    class EventRing
+    {
+    private:
+        SpscRing<EventRecord> records_;
+        std::unique_ptr<char[]> names_;
+        std::size_t names_mask_;
+        uint8_t shard_;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> names_head_ = 0; // Written by the producer
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> names_tail_ = 0; // Written by the consumer
+
+    public:
+        static constexpr std::size_t AVERAGE_NAME_LENGTH = 32;
+
+        explicit EventRing(std::size_t capacity, uint8_t shard = 0)
+            : records_(capacity),
+              names_(std::make_unique<char[]>(records_.capacity() * AVERAGE_NAME_LENGTH)),
+              names_mask_(records_.capacity() * AVERAGE_NAME_LENGTH - 1),
+              shard_(shard)
+        {
+        }
+
+        // Producer side, false when either ring is full and the event has to be dropped
+        bool push(int64_t timestamp, int wd, uint32_t mask, uint32_t cookie, std::string_view name, uint8_t kind = 0, int from_wd = -1)
+        {
+            EventRecord record{timestamp, wd, mask, cookie, 0, static_cast<uint16_t>(name.size()), kind, shard_, from_wd};
+            if (!name.empty())
+            {
+                std::size_t head = names_head_.load(std::memory_order_relaxed);
+                std::size_t offset = head & names_mask_;
+                std::size_t skip = offset + name.size() > names_mask_ + 1 ? names_mask_ + 1 - offset : 0;
+                std::size_t used = head - names_tail_.load(std::memory_order_acquire);
+                if (used + skip + name.size() > names_mask_ + 1)
+                {
+                    return false;
+                }
+                offset = (head + skip) & names_mask_;
+                std::memcpy(names_.get() + offset, name.data(), name.size());
+                record.name_offset = static_cast<uint32_t>(offset);
+                if (!records_.push(record))
+                {
+                    return false;
+                }
+                names_head_.store(head + skip + name.size(), std::memory_order_release);
+                return true;
+            }
+            return records_.push(record);
+        }
+
+        // Consumer side, calls func(const EventRecord &, std::string_view name) for up to limit events.
+        // The name view is only valid during the call
+        template <typename Callable>
+        std::size_t consume(Callable &&func, std::size_t limit = SIZE_MAX)
+        {
+            std::size_t count = 0;
+            const EventRecord *record;
+            while (count < limit && (record = records_.front()) != nullptr)
+            {
+                std::string_view name(names_.get() + record->name_offset, record->name_length);
+                func(*record, name);
+                if (record->name_length != 0)
+                {
+                    std::size_t tail = names_tail_.load(std::memory_order_relaxed);
+                    std::size_t skip = (record->name_offset - (tail & names_mask_)) & names_mask_;
+                    names_tail_.store(tail + skip + record->name_length, std::memory_order_release);
+                }
+                records_.pop();
+                ++count;
+            }
+            return count;
+        }
+
+        std::size_t size() const { return records_.size(); }
+        bool empty() const { return records_.empty(); }
+        std::size_t capacity() const { return records_.capacity(); }
+    };
+}
@@ -0,0 +1,271 @@
+#pragma once
+#include <sys/inotify.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace inotify
+{
+    // Event counters per watch, as printed by inotifywatch. Rows are created on the first event
+    // counted for a key (the wd), so memory grows with the number of active watches, never with the
+    // number of events. Keys live in a flat open-addressing table with linear probing that maps
+    // them to dense 32-bit row ids; one event costs a multiplicative hash, usually one probe and an
+    // increment per mask bit. One thread writes, the reader thread owning the table, while others
+    // read it through forEach() without a lock: rows sit in chunks that never move, counters are
+    // relaxed atomics, and a new row is published with the row count
+    class EventStatistics
+    {
+    public:
+        static constexpr std::size_t COLUMNS = 14;
+        using Counters = std::array<uint64_t, COLUMNS>;
+
+        // Column 0 counts events, the others one event type each, in inotifywatch's order
+        static constexpr std::array<uint32_t, COLUMNS> COLUMN_MASKS = {
+            0, IN_ACCESS, IN_MODIFY, IN_ATTRIB, IN_CLOSE_WRITE, IN_CLOSE_NOWRITE, IN_OPEN,
+            IN_MOVED_FROM, IN_MOVED_TO, IN_MOVE_SELF, IN_CREATE, IN_DELETE, IN_DELETE_SELF, IN_UNMOUNT};
+        static constexpr std::array<const char *, COLUMNS> COLUMN_NAMES = {
+            "total", "access", "modify", "attrib", "close_write", "close_nowrite", "open",
+            "moved_from", "moved_to", "move_self", "create", "delete", "delete_self", "unmount"};
+        static constexpr uint32_t COUNTED = IN_ALL_EVENTS | IN_UNMOUNT;
+        static constexpr uint32_t RETIRED = 0x80000000u;   // Keys from here on hold the counts of released watches, wds stay below
+
+    private:
+        static constexpr uint32_t EMPTY = UINT32_MAX;
+
+        struct Slot
+        {
+            uint32_t key = EMPTY;
+            uint32_t id = 0;
+        };
+
+        struct Row
+        {
+            uint32_t key = EMPTY;                            // Set before the row is published
+            std::array<std::atomic<uint64_t>, COLUMNS> counters = {};
+        };
+
+        static constexpr std::size_t CHUNK_ROWS = 512;
+        static constexpr std::size_t MAX_CHUNKS = 4096;      // Two million watches per table
+
+        static constexpr std::array<uint8_t, 32> BIT_COLUMNS = []()
+        {
+            std::array<uint8_t, 32> columns = {};
+            for (std::size_t column = 1; column < COLUMNS; ++column)
+            {
+                columns[std::countr_zero(COLUMN_MASKS[column])] = static_cast<uint8_t>(column);
+            }
+            return columns;
+        }();
+
+        std::vector<Slot> slots_ = std::vector<Slot>(64); // Power of two, at most half full, writer only
+        std::unique_ptr<std::unique_ptr<Row[]>[]> chunks_ = std::make_unique<std::unique_ptr<Row[]>[]>(MAX_CHUNKS);
+        std::atomic<uint32_t> size_ = 0;                    // Published rows
+
+        Row &at(uint32_t id) const
+        {
+            return chunks_[id / CHUNK_ROWS][id % CHUNK_ROWS];
+        }
+
+        static void increment(std::atomic<uint64_t> &counter)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); // Single writer
+        }
+
+        static std::size_t hash(uint32_t key)
+        {
+            return static_cast<std::size_t>((uint64_t(key) * 0x9e3779b97f4a7c15ull) >> 32);
+        }
+
+        void grow()
+        {
+            std::vector<Slot> slots(slots_.size() * 2);
+            std::size_t mask = slots.size() - 1;
+            for (const Slot &slot : slots_)
+            {
+                if (slot.key == EMPTY)
+                {
+                    continue;
+                }
+                std::size_t i = hash(slot.key) & mask;
+                while (slots[i].key != EMPTY)
+                {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+            slots_ = std::move(slots);
+        }
+
+        // Slot of key, or the empty slot where it would go
+        std::size_t locate(uint32_t key) const
+        {
+            std::size_t mask = slots_.size() - 1;
+            std::size_t i = hash(key) & mask;
+            while (slots_[i].key != key && slots_[i].key != EMPTY)
+            {
+                i = (i + 1) & mask;
+            }
+            return i;
+        }
+
+        // Row of key, created if there is none. nullptr once the table is full
+        Row *row(uint32_t key)
+        {
+            std::size_t i = this->locate(key);
+            if (slots_[i].key == key)
+            {
+                return &this->at(slots_[i].id);
+            }
+            uint32_t id = size_.load(std::memory_order_relaxed);
+            if (id == CHUNK_ROWS * MAX_CHUNKS)
+            {
+                return nullptr;
+            }
+            if (id % CHUNK_ROWS == 0)
+            {
+                chunks_[id / CHUNK_ROWS] = std::make_unique<Row[]>(CHUNK_ROWS);
+            }
+            this->at(id).key = key;
+            size_.store(id + 1, std::memory_order_release);
+            slots_[i] = Slot{key, id};
+            if ((id + 1) * 2 > slots_.size())
+            {
+                this->grow();
+            }
+            return &this->at(id);
+        }
+
+    public:
+        // Counts one event with the COUNTED bits of mask for key, nothing if there are none
+        void add(uint32_t key, uint32_t mask)
+        {
+            mask &= COUNTED;
+            if (mask == 0 || key == EMPTY)
+            {
+                return;
+            }
+            Row *row = this->row(key);
+            if (row == nullptr)
+            {
+                return;
+            }
+            increment(row->counters[0]);
+            for (; mask != 0; mask &= mask - 1)
+            {
+                increment(row->counters[BIT_COLUMNS[std::countr_zero(mask)]]);
+            }
+        }
+
+        // Whether key has events counted. Writer only
+        bool counted(uint32_t key) const
+        {
+            std::size_t i = this->locate(key);
+            return slots_[i].key == key && this->at(slots_[i].id).counters[0].load(std::memory_order_relaxed) != 0;
+        }
+
+        // Adds the counters of key to those of target and starts key over, for a wd the kernel may
+        // hand out again while its counts stay reported. Writer only
+        void retire(uint32_t key, uint32_t target)
+        {
+            std::size_t i = this->locate(key);
+            if (slots_[i].key != key)
+            {
+                return;
+            }
+            Row &from = this->at(slots_[i].id);
+            if (Row *to = this->row(target))
+            {
+                for (std::size_t column = 0; column < COLUMNS; ++column)
+                {
+                    uint64_t count = from.counters[column].load(std::memory_order_relaxed);
+                    to->counters[column].store(to->counters[column].load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+                }
+            }
+            for (std::atomic<uint64_t> &counter : from.counters)
+            {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // Starts the counters of key over, for a wd the kernel may hand out again. Writer only
+        void reset(uint32_t key)
+        {
+            std::size_t i = this->locate(key);
+            if (slots_[i].key == key)
+            {
+                for (std::atomic<uint64_t> &counter : this->at(slots_[i].id).counters)
+                {
+                    counter.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // func(uint32_t key, const Counters &) per row with events, in the order the keys were first
+        // seen. Safe while the writer counts, a row copied meanwhile may miss its latest events
+        template <typename Callable>
+        void forEach(Callable &&func) const
+        {
+            uint32_t size = size_.load(std::memory_order_acquire);
+            Counters counters;
+            for (uint32_t id = 0; id < size; ++id)
+            {
+                const Row &row = this->at(id);
+                for (std::size_t column = 0; column < COLUMNS; ++column)
+                {
+                    counters[column] = row.counters[column].load(std::memory_order_relaxed);
+                }
+                if (counters[0] != 0)
+                {
+                    func(row.key, counters);
+                }
+            }
+        }
+
+        // Rows ever created, an upper bound for the rows forEach() reports
+        std::size_t size() const { return size_.load(std::memory_order_acquire); }
+
+        // Starts every counter over, rows are kept for their keys. Writer only
+        void clear()
+        {
+            for (uint32_t id = 0; id < size_.load(std::memory_order_relaxed); ++id)
+            {
+                for (std::atomic<uint64_t> &counter : this->at(id).counters)
+                {
+                    counter.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Column of an event name as printed ("close_write", case does not matter), -1 if unknown
+        static int column(std::string_view name)
+        {
+            for (std::size_t column = 0; column < COLUMNS; ++column)
+            {
+                std::string_view candidate = COLUMN_NAMES[column];
+                if (candidate.size() == name.size() && std::equal(name.begin(), name.end(), candidate.begin(), [](char a, char b)
+                {
+                    return std::tolower(static_cast<unsigned char>(a)) == b;
+                }))
+                {
+                    return static_cast<int>(column);
+                }
+            }
+            return -1;
+        }
+    };
+
+    // One line of the statistics table
+    struct StatisticsRow
+    {
+        std::filesystem::path path;
+        EventStatistics::Counters counts = {};
+    };
+}
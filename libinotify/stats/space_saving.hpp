@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+namespace inotify
+{
+    // Space-Saving heavy hitters sketch (Metwally, Agrawal, El Abbadi) over 64-bit key fingerprints.
+    // Keeps at most capacity counters: a key without a counter takes over the smallest one and
+    // inherits its count as error. Every key whose true count exceeds total() / capacity() has a
+    // counter, and no count is overestimated by more than its error, itself at most total() / capacity().
+    // Counters form a min-heap, their positions are found through a flat open-addressing table, so
+    // an update is one probe plus a sift of O(log capacity). Label describes a key for reports and is
+    // built only when a key takes over a counter. Not thread safe
+    template <typename Label>
+    class SpaceSaving
+    {
+    public:
+        struct Counter
+        {
+            uint64_t key;
+            uint64_t count;
+            uint64_t error; // count - error is a lower bound of the true count
+            Label label;
+        };
+
+    private:
+        struct Slot
+        {
+            uint64_t key = 0; // 0 marks an empty slot, keys are made non-zero
+            uint32_t position = 0;
+        };
+
+        std::size_t capacity_;
+        std::vector<Counter> heap_;
+        std::vector<Slot> slots_;
+        uint64_t total_ = 0;
+
+        static uint64_t normalize(uint64_t key) { return key != 0 ? key : 1; }
+        std::size_t home(uint64_t key) const { return static_cast<std::size_t>((key * 0x9e3779b97f4a7c15ull) >> 32) & (slots_.size() - 1); }
+
+        std::size_t find(uint64_t key) const
+        {
+            std::size_t mask = slots_.size() - 1;
+            std::size_t i = home(key);
+            while (slots_[i].key != 0 && slots_[i].key != key)
+            {
+                i = (i + 1) & mask;
+            }
+            return i;
+        }
+
+        // Backward-shift deletion keeps probe sequences intact without tombstones
+        void erase(uint64_t key)
+        {
+            std::size_t mask = slots_.size() - 1;
+            std::size_t hole = this->find(key);
+            if (slots_[hole].key == 0)
+            {
+                return;
+            }
+            for (std::size_t i = (hole + 1) & mask; slots_[i].key != 0; i = (i + 1) & mask)
+            {
+                std::size_t ideal = home(slots_[i].key);
+                if (((i - ideal) & mask) >= ((i - hole) & mask))
+                {
+                    slots_[hole] = slots_[i];
+                    hole = i;
+                }
+            }
+            slots_[hole] = Slot();
+        }
+
+        void place(std::size_t position)
+        {
+            slots_[this->find(heap_[position].key)].position = static_cast<uint32_t>(position);
+        }
+
+        void siftDown(std::size_t position)
+        {
+            while (true)
+            {
+                std::size_t smallest = position;
+                for (std::size_t child = 2 * position + 1; child <= 2 * position + 2 && child < heap_.size(); ++child)
+                {
+                    if (heap_[child].count < heap_[smallest].count)
+                    {
+                        smallest = child;
+                    }
+                }
+                if (smallest == position)
+                {
+                    return;
+                }
+                std::swap(heap_[position], heap_[smallest]);
+                this->place(position);
+                this->place(smallest);
+                position = smallest;
+            }
+        }
+
+        void siftUp(std::size_t position)
+        {
+            while (position > 0 && heap_[(position - 1) / 2].count > heap_[position].count)
+            {
+                std::swap(heap_[position], heap_[(position - 1) / 2]);
+                this->place(position);
+                position = (position - 1) / 2;
+                this->place(position);
+            }
+        }
+
+    public:
+        explicit SpaceSaving(std::size_t capacity)
+            : capacity_(std::max<std::size_t>(capacity, 1)), slots_(std::bit_ceil(std::max<std::size_t>(capacity, 1) * 2))
+        {
+            heap_.reserve(capacity_);
+        }
+
+        // Counts weight occurrences of key, make_label() is called when key gets a counter
+        template <typename MakeLabel>
+        void add(uint64_t key, MakeLabel &&make_label, uint64_t weight = 1)
+        {
+            key = normalize(key);
+            total_ += weight;
+            std::size_t slot = this->find(key);
+            if (slots_[slot].key == key)
+            {
+                std::size_t position = slots_[slot].position;
+                heap_[position].count += weight;
+                this->siftDown(position);
+                return;
+            }
+            if (heap_.size() < capacity_)
+            {
+                heap_.push_back(Counter{key, weight, 0, make_label()});
+                slots_[slot] = Slot{key, static_cast<uint32_t>(heap_.size() - 1)};
+                this->siftUp(heap_.size() - 1);
+                return;
+            }
+            // Evict the minimum, the newcomer may have occurred up to that many times unseen
+            Counter &minimum = heap_.front();
+            this->erase(minimum.key);
+            minimum.error = minimum.count;
+            minimum.count += weight;
+            minimum.key = key;
+            minimum.label = make_label();
+            slots_[this->find(key)] = Slot{key, 0};
+            this->siftDown(0);
+        }
+
+        // In heap order, not sorted
+        const std::vector<Counter> &counters() const { return heap_; }
+        uint64_t total() const { return total_; }
+        std::size_t capacity() const { return capacity_; }
+
+        // Largest possible overestimate of any count
+        uint64_t errorBound() const { return heap_.size() < capacity_ ? 0 : heap_.front().count; }
+
+        void clear()
+        {
+            heap_.clear();
+            std::fill(slots_.begin(), slots_.end(), Slot());
+            total_ = 0;
+        }
+    };
+
+    enum class HotPathKind
+    {
+        FILES,      // Entries, and watched directories for events on themselves
+        DIRECTORIES // Watched directories, counting the events of their entries
+    };
+
+    // One heavy hitter. The true count lies in [count - error, count]
+    struct HotPath
+    {
+        std::filesystem::path path;
+        uint64_t count = 0;
+        uint64_t error = 0;
+        bool guaranteed = false; // count - error beats every path left out, so it is certainly in the top k
+    };
+}
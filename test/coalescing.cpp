@@ -0,0 +1,44 @@
+#include <libinotify/libinotify.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+// A directory created inside a recursive watch while coalescing is on is watched, and what is
+// created below it afterwards is reported
+int main()
+{
+  char pattern[] = "/tmp/libinotify_coalescing_XXXXXX";
+  if (mkdtemp(pattern) == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::filesystem::path root = std::filesystem::canonical(pattern);
+
+  int result = 1;
+  {
+    inotify::Watcher watcher;
+    watcher.setVerbose(false);
+    watcher.setCoalescing(std::chrono::milliseconds(20));
+    watcher.recursive(root.string());
+
+    std::filesystem::create_directories(root / "a" / "b");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::ofstream(root / "a" / "b" / "file") << "x";
+
+    std::vector<inotify::FileEvent> events;
+    for (int i = 0; i < 50 && result != 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      for (auto& event : watcher.getCurrentEvents()) {
+        if (event.path == root / "a" / "b" / "file" && (event.mask & IN_CREATE)) {
+          result = 0;
+        }
+        events.push_back(std::move(event));
+      }
+    }
+    if (result != 0) {
+      std::fprintf(stderr, "No CREATE for %s, got %zu events\n", (root / "a" / "b" / "file").c_str(), events.size());
+    }
+  }
+
+  std::filesystem::remove_all(root);
+  return result;
+}
@@ -0,0 +1,56 @@
+#include <libinotify/libinotify.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+// With the fanotify backend, a file renamed from one watched directory to another is reported as
+// one rename. Skipped without CAP_SYS_ADMIN or fanotify support
+int main()
+{
+  char pattern[] = "/tmp/libinotify_fanotify_XXXXXX";
+  if (mkdtemp(pattern) == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::filesystem::path root = std::filesystem::canonical(pattern);
+
+  int result = 1;
+  {
+    inotify::Watcher watcher;
+    watcher.setVerbose(false);
+    try {
+      watcher.setBackend(inotify::BackendType::FANOTIFY);
+    } catch (const std::exception& error) {
+      std::fprintf(stderr, "Skipped: %s\n", error.what());
+      std::filesystem::remove_all(root);
+      return 77;
+    }
+
+    std::filesystem::create_directories(root / "a");
+    std::filesystem::create_directories(root / "b");
+    std::ofstream(root / "a" / "file") << "x";
+    watcher.recursive(root.string());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::filesystem::rename(root / "a" / "file", root / "b" / "renamed");
+
+    std::vector<inotify::FileEvent> events;
+    for (int i = 0; i < 50 && result != 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      for (auto& event : watcher.getCurrentEvents()) {
+        if (event.kind == inotify::EventKind::RENAME && event.from == root / "a" / "file" && event.path == root / "b" / "renamed") {
+          result = 0;
+        }
+        events.push_back(std::move(event));
+      }
+    }
+    if (result != 0) {
+      std::fprintf(stderr, "No rename of %s, got %zu events\n", (root / "a" / "file").c_str(), events.size());
+      for (const auto& event : events) {
+        std::cerr << event << '\n';
+      }
+    }
+  }
+
+  std::filesystem::remove_all(root);
+  return result;
+}
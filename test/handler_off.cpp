@@ -0,0 +1,61 @@
+#include <libinotify/libinotify.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+// A handler that unregisters itself with off() returns and is not called again, whether it runs
+// on the reader thread or on a handler thread
+int main()
+{
+  char pattern[] = "/tmp/libinotify_handler_off_XXXXXX";
+  if (mkdtemp(pattern) == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::filesystem::path root = std::filesystem::canonical(pattern);
+
+  int result = 0;
+  {
+    inotify::Watcher watcher;
+    watcher.setVerbose(false);
+    std::atomic<int> others = 0;
+    watcher.on(IN_CREATE, "", [&](const inotify::EventRef&) { ++others; });
+    watcher.recursive(root.string());
+
+    for (unsigned threads : {0u, 2u}) {
+      watcher.setHandlerThreads(threads);
+      std::atomic<int> calls = 0;
+      std::atomic<bool> registered = false;
+      inotify::EventDispatcher::HandlerId id = 0;
+      id = watcher.on(IN_CREATE, "", [&](const inotify::EventRef&) {
+        while (!registered) {
+          std::this_thread::yield();
+        }
+        ++calls;
+        if (!watcher.off(id)) {
+          result = 1;
+        }
+      });
+      registered = true;
+
+      others = 0;
+      for (int i = 0; i < 3; ++i) {
+        std::ofstream(root / ("file" + std::to_string(threads) + "_" + std::to_string(i))) << "x";
+      }
+      for (int i = 0; i < 100 && others < 3; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      if (calls != 1 || others != 3) {
+        std::fprintf(stderr, "With %u handler threads: removed handler called %d times, other handler %d times\n", threads, calls.load(), others.load());
+        result = 1;
+      }
+      if (watcher.off(id)) {
+        std::fprintf(stderr, "With %u handler threads: handler still registered\n", threads);
+        result = 1;
+      }
+    }
+  }
+
+  std::filesystem::remove_all(root);
+  return result;
+}
@@ -0,0 +1,58 @@
+#include <libinotify/queue/mpmc_ring.hpp>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Several producers push distinct values through a small ring to several consumers, every value
+// comes out exactly once
+int main()
+{
+  constexpr unsigned producers = 4;
+  constexpr unsigned consumers = 4;
+  constexpr std::size_t per_producer = 200000;
+  constexpr std::size_t total = producers * per_producer;
+
+  inotify::MpmcRing<std::size_t> ring(64);
+  std::vector<std::atomic<unsigned>> seen(total);
+  std::atomic<std::size_t> popped = 0;
+
+  std::vector<std::thread> threads;
+  for (unsigned p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p]() {
+      for (std::size_t i = 0; i < per_producer; ++i) {
+        while (!ring.push(p * per_producer + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (unsigned c = 0; c < consumers; ++c) {
+    threads.emplace_back([&]() {
+      std::size_t value;
+      while (popped.load(std::memory_order_relaxed) < total) {
+        if (ring.pop(value)) {
+          seen[value].fetch_add(1, std::memory_order_relaxed);
+          popped.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (std::size_t i = 0; i < total; ++i) {
+    if (seen[i].load() != 1) {
+      std::fprintf(stderr, "Value %zu came out %u times\n", i, seen[i].load());
+      return 1;
+    }
+  }
+  if (!ring.empty()) {
+    std::fprintf(stderr, "%zu values left in the ring\n", ring.size());
+    return 1;
+  }
+  return 0;
+}
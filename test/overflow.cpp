@@ -0,0 +1,85 @@
+#include <libinotify/libinotify.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+// A file created and reported before the kernel queue overflows is not reported again by the
+// overflow recovery, neither is any other file. The reader thread is held in a handler while
+// enough files are created to overflow the queue
+int main()
+{
+  std::size_t queued = 0;
+  std::ifstream("/proc/sys/fs/inotify/max_queued_events") >> queued;
+  if (queued == 0 || queued > 1000000) {
+    std::fprintf(stderr, "Skipped: max_queued_events is %zu\n", queued);
+    return 77;
+  }
+
+  char pattern[] = "/tmp/libinotify_overflow_XXXXXX";
+  if (mkdtemp(pattern) == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::filesystem::path root = std::filesystem::canonical(pattern);
+
+  int result = 0;
+  {
+    inotify::Watcher watcher;
+    watcher.setVerbose(false);
+    watcher.setOverflowRecovery(inotify::OverflowRecovery::FULL);
+    std::atomic<bool> hold = true;
+    std::atomic<bool> held = false;
+    watcher.on(IN_CREATE, "", [&](const inotify::EventRef&) {
+      held = true;
+      while (hold) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+    watcher.recursive(root.string());
+
+    std::ofstream(root / "first") << "x";
+    while (!held) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // Every file adds CREATE, OPEN, MODIFY and CLOSE_WRITE, about a third more than the queue holds
+    for (std::size_t i = 0; i < queued / 3; ++i) {
+      std::ofstream(root / ("file" + std::to_string(i))) << "x";
+    }
+    hold = false;
+
+    bool overflow = false;
+    std::map<std::filesystem::path, int> creates;
+    for (int i = 0; i < 400; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      for (auto& event : watcher.getCurrentEvents()) {
+        overflow = overflow || event.kind == inotify::EventKind::OVERFLOW;
+        if (event.mask & IN_CREATE) {
+          ++creates[event.path];
+        }
+      }
+    }
+
+    if (!overflow) {
+      std::fprintf(stderr, "The queue did not overflow\n");
+      result = 1;
+    }
+    if (creates[root / "first"] != 1) {
+      std::fprintf(stderr, "CREATE of %s reported %d times\n", (root / "first").c_str(), creates[root / "first"]);
+      result = 1;
+    }
+    for (const auto& [path, count] : creates) {
+      if (count != 1) {
+        std::fprintf(stderr, "CREATE of %s reported %d times\n", path.c_str(), count);
+        result = 1;
+        break;
+      }
+    }
+    if (creates.size() != queued / 3 + 1) {
+      std::fprintf(stderr, "%zu of %zu files reported\n", creates.size(), queued / 3 + 1);
+      result = 1;
+    }
+  }
+
+  std::filesystem::remove_all(root);
+  return result;
+}
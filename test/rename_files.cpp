@@ -0,0 +1,60 @@
+#include <libinotify/libinotify.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+// With WatchMode::FILES a renamed file keeps its watch under the new name: its MOVE_SELF and the
+// events on its own watch afterwards carry the new path
+int main()
+{
+  char pattern[] = "/tmp/libinotify_rename_files_XXXXXX";
+  if (mkdtemp(pattern) == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::filesystem::path root = std::filesystem::canonical(pattern);
+
+  int result = 0;
+  {
+    inotify::Watcher watcher;
+    watcher.setVerbose(false);
+    watcher.setWatchMode(inotify::WatchMode::FILES);
+    std::ofstream(root / "file") << "x";
+    watcher.recursive(root.string());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::filesystem::rename(root / "file", root / "renamed");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::filesystem::permissions(root / "renamed", std::filesystem::perms::owner_exec, std::filesystem::perm_options::add);
+
+    std::vector<inotify::FileEvent> events;
+    int move_self = 0;
+    int attrib = 0;
+    for (int i = 0; i < 50 && attrib < 2; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      for (auto& event : watcher.getCurrentEvents()) {
+        if (event.mask & IN_MOVE_SELF) {
+          ++move_self;
+          result = event.path == root / "renamed" ? result : 1;
+        }
+        if (event.mask & IN_ATTRIB) {
+          ++attrib;
+          result = event.path == root / "renamed" ? result : 1;
+        }
+        events.push_back(std::move(event));
+      }
+    }
+    // One ATTRIB from the directory's watch, one from the file's
+    if (move_self != 1 || attrib != 2) {
+      result = 1;
+    }
+    if (result != 0) {
+      std::fprintf(stderr, "Rename of %s not followed, got %zu events\n", (root / "file").c_str(), events.size());
+      for (const auto& event : events) {
+        std::cerr << event << '\n';
+      }
+    }
+  }
+
+  std::filesystem::remove_all(root);
+  return result;
+}
@@ -0,0 +1,52 @@
+#include <libinotify/libinotify.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+// The counts of a watched directory stay reported after it is deleted and its wd is released,
+// also once the wd is handed out to a new directory
+int main()
+{
+  char pattern[] = "/tmp/libinotify_statistics_XXXXXX";
+  if (mkdtemp(pattern) == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::filesystem::path root = std::filesystem::canonical(pattern);
+
+  int result = 0;
+  {
+    inotify::Watcher watcher;
+    watcher.setVerbose(false);
+    watcher.setStatistics(true);
+    std::filesystem::create_directories(root / "sub");
+    watcher.recursive(root.string());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (int i = 0; i < 5; ++i) {
+      std::ofstream(root / "sub" / ("file" + std::to_string(i))) << "x";
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::filesystem::remove_all(root / "sub");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::filesystem::create_directories(root / "other");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::ofstream(root / "other" / "file") << "x";
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int create = inotify::EventStatistics::column("create");
+    uint64_t created = 0;
+    for (const auto& row : watcher.getStatistics()) {
+      if (row.path == root / "sub") {
+        created += row.counts[create];
+      }
+    }
+    if (created != 5) {
+      std::fprintf(stderr, "%s counted %llu creates, expected 5\n", (root / "sub").c_str(), static_cast<unsigned long long>(created));
+      std::cerr << watcher.formatStatistics();
+      result = 1;
+    }
+  }
+
+  std::filesystem::remove_all(root);
+  return result;
+}